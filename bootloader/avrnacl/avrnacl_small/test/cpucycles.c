@@ -0,0 +1,48 @@
+/*
+ * File:    avrnacl_small/test/cpucycles.c
+ * Public Domain
+ */
+
+/*
+ * Cycle counter from Timer1 running at the CPU clock, with
+ * the overflow interrupt counting the upper 16 bits.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "cpucycles.h"
+
+static volatile uint16_t overflows;
+
+ISR(TIMER1_OVF_vect)
+{
+  overflows++;
+}
+
+void cpucycles_init(void)
+{
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  overflows = 0;
+  TIFR1 = (1 << TOV1);
+  TIMSK1 = (1 << TOIE1);
+  TCCR1B = (1 << CS10); /* no prescaling */
+  sei();
+}
+
+uint32_t cpucycles(void)
+{
+  uint8_t sreg = SREG;
+  uint32_t t;
+
+  cli();
+  t = TCNT1;
+  /* overflow pending but not yet counted */
+  if((TIFR1 & (1 << TOV1)) && t < 0x8000)
+    t += 0x10000;
+  t += (uint32_t)overflows << 16;
+  SREG = sreg;
+  return t;
+}
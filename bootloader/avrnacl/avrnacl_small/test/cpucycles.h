@@ -0,0 +1,14 @@
+/*
+ * File:    avrnacl_small/test/cpucycles.h
+ * Public Domain
+ */
+
+#ifndef CPUCYCLES_H
+#define CPUCYCLES_H
+
+#include <stdint.h>
+
+void cpucycles_init(void);
+uint32_t cpucycles(void);
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * File:    avrnacl_small/test/print.c
+ * Public Domain
+ */
+
+/*
+ * Output through the simavr console register: bytes written
+ * to GPIOR0 are collected and printed as a line on '\r'.
+ */
+
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/avr_mcu_section.h>
+
+#include "print.h"
+
+AVR_MCU(F_CPU, MCU_NAME);
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR0);
+
+void print(const char *s)
+{
+  while(*s)
+    GPIOR0 = *s++;
+}
+
+void print_u32(uint32_t x)
+{
+  char buf[11];
+  print(ultoa(x, buf, 10));
+}
+
+/* One "<name> <len> <what> <x>" line */
+void print_line(const char *name, uint16_t len, const char *what, uint32_t x)
+{
+  print(PRINT_TAG);
+  print(name);
+  print(" ");
+  print_u32(len);
+  print(" ");
+  print(what);
+  print(" ");
+  print_u32(x);
+  print_end();
+}
+
+void print_end(void)
+{
+  GPIOR0 = '\r';
+}
+
+/* simavr stops when the core sleeps with interrupts off */
+void sim_exit(void)
+{
+  cli();
+  sleep_enable();
+  sleep_cpu();
+  for(;;);
+}
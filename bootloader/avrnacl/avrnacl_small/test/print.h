@@ -0,0 +1,21 @@
+/*
+ * File:    avrnacl_small/test/print.h
+ * Public Domain
+ */
+
+#ifndef PRINT_H
+#define PRINT_H
+
+#include <stdint.h>
+
+/* Every line starts with this tag so the logs can be cut
+ * out of whatever else the simulator prints */
+#define PRINT_TAG "AVRNACL "
+
+void print(const char *s);
+void print_u32(uint32_t x);
+void print_line(const char *name, uint16_t len, const char *what, uint32_t x);
+void print_end(void);
+void sim_exit(void);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * File:    avrnacl_small/test/speed.c
+ * Public Domain
+ */
+
+/*
+ * Cycle counts and stack usage of the primitives the
+ * bootloader uses, one "<primitive> <bytes> cycles <n>" and
+ * one "<primitive> <bytes> stack <n>" line per measurement.
+ * Cycle counts are the median of SPEED_RUNS runs, less the
+ * cost of reading the counter.
+ */
+
+#include <stdint.h>
+
+#include "avrnacl.h"
+#include "print.h"
+#include "cpucycles.h"
+#include "stack.h"
+
+#define SPEED_RUNS 5
+#define SPEED_MAXLEN 1024
+
+static const uint16_t lengths[] = {0, 8, 64, 128, 256, 278, 512, 1024};
+#define NLENGTHS (sizeof(lengths) / sizeof(lengths[0]))
+
+static const unsigned char sigma[16] = "expand 32-byte k";
+static const unsigned char nonce[24] = {0};
+
+static unsigned char key[32];
+static unsigned char state[64];
+static unsigned char in[16];
+static unsigned char out[64];
+static unsigned char m[SPEED_MAXLEN];
+static unsigned char c[SPEED_MAXLEN];
+static uint32_t overhead;
+
+#define OP_HASH 0
+#define OP_HASHBLOCKS 1
+#define OP_SALSA20 2
+#define OP_HSALSA20 3
+#define OP_XSALSA20 4
+#define OP_VERIFY 5
+
+static void run(uint8_t op, uint16_t len)
+{
+  switch(op)
+  {
+    case OP_HASH:
+      crypto_hash_sha512(out,m,len);
+      break;
+    case OP_HASHBLOCKS:
+      crypto_hashblocks_sha512(state,m,len);
+      break;
+    case OP_SALSA20:
+      crypto_core_salsa20(out,in,key,sigma);
+      break;
+    case OP_HSALSA20:
+      crypto_core_hsalsa20(out,in,key,sigma);
+      break;
+    case OP_XSALSA20:
+      crypto_stream_xsalsa20_xor(c,m,len,nonce,key);
+      break;
+    default:
+      crypto_verify_32(m,c);
+      break;
+  }
+}
+
+static void measure(const char *name, uint8_t op, uint16_t len)
+{
+  uint32_t t[SPEED_RUNS], x;
+  uint8_t i, j;
+
+  for(i=0;i<SPEED_RUNS;i++)
+  {
+    t[i] = cpucycles();
+    run(op,len);
+    t[i] = cpucycles() - t[i] - overhead;
+  }
+
+  /* insertion sort for the median */
+  for(i=1;i<SPEED_RUNS;i++)
+    for(j=i;j>0 && t[j-1]>t[j];j--)
+    {
+      x = t[j]; t[j] = t[j-1]; t[j-1] = x;
+    }
+  print_line(name,len,"cycles",t[SPEED_RUNS/2]);
+
+  stack_paint();
+  run(op,len);
+  print_line(name,len,"stack",stack_count());
+}
+
+int main(void)
+{
+  uint8_t i;
+  uint32_t t;
+
+  cpucycles_init();
+  t = cpucycles();
+  overhead = cpucycles() - t;
+
+  for(i=0;i<NLENGTHS;i++)
+    measure("crypto_hash_sha512",OP_HASH,lengths[i]);
+  for(i=0;i<NLENGTHS;i++)
+    if(lengths[i] % 128 == 0)
+      measure("crypto_hashblocks_sha512",OP_HASHBLOCKS,lengths[i]);
+  measure("crypto_core_salsa20",OP_SALSA20,64);
+  measure("crypto_core_hsalsa20",OP_HSALSA20,32);
+  for(i=0;i<NLENGTHS;i++)
+    measure("crypto_stream_xsalsa20_xor",OP_XSALSA20,lengths[i]);
+  measure("crypto_verify_32",OP_VERIFY,32);
+
+  sim_exit();
+  return 0;
+}
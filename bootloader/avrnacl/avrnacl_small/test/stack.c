@@ -0,0 +1,45 @@
+/*
+ * File:    avrnacl_small/test/stack.c
+ * Public Domain
+ */
+
+/*
+ * Stack measurement by painting: stack_paint() fills the
+ * free stack below its caller with a canary, and
+ * stack_count() returns how deep the calls made in between
+ * went, counted from the caller's stack pointer.
+ */
+
+#include <avr/io.h>
+
+#include "stack.h"
+
+#define CANARY 0xa5
+
+extern unsigned char __heap_start;
+
+static unsigned char *top;
+static unsigned char *bottom;
+
+void stack_paint(void)
+{
+  unsigned char *p;
+
+  /* Stop short of this function's own frame */
+  top = (unsigned char *)SP - 16;
+  bottom = top - STACK_PAINT_BYTES;
+  if(bottom < &__heap_start)
+    bottom = &__heap_start;
+
+  for(p = bottom; p < top; p++)
+    *p = CANARY;
+}
+
+uint16_t stack_count(void)
+{
+  unsigned char *p = bottom;
+
+  while(p < top && *p == CANARY)
+    p++;
+  return top + 16 - p;
+}
@@ -0,0 +1,17 @@
+/*
+ * File:    avrnacl_small/test/stack.h
+ * Public Domain
+ */
+
+#ifndef STACK_H
+#define STACK_H
+
+#include <stdint.h>
+
+/* Bytes below the caller's frame painted before a call */
+#define STACK_PAINT_BYTES 3072
+
+void stack_paint(void);
+uint16_t stack_count(void);
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ * File:    avrnacl_small/test/test.c
+ * Public Domain
+ */
+
+/*
+ * Known-answer tests for the primitives the bootloader uses.
+ *
+ * Fixed vectors come from the NaCl tests (core1, stream3) and
+ * FIPS 180-2. The checksums chain the outputs for every message
+ * length below TEST_MAXLEN: acc = SHA512(acc || SHA512(out)).
+ */
+
+#include <stdint.h>
+
+#include "avrnacl.h"
+#include "print.h"
+
+#define TEST_MAXLEN 300
+
+extern const unsigned char avrnacl_sha512_iv[64];
+
+static const unsigned char sigma[16] = "expand 32-byte k";
+
+static const unsigned char shared[32] = {
+  0x4a,0x5d,0x9d,0x5b,0xa4,0xce,0x2d,0xe1,0x72,0x8e,0x3b,0xf4,0x80,0x35,0x0f,0x25,
+  0xe0,0x7e,0x21,0xc9,0x47,0xd1,0x9e,0x33,0x76,0xf0,0x9b,0x3c,0x1e,0x16,0x17,0x42};
+
+static const unsigned char firstkey[32] = {
+  0x1b,0x27,0x55,0x64,0x73,0xe9,0x85,0xd4,0x62,0xcd,0x51,0x19,0x7a,0x9a,0x46,0xc7,
+  0x60,0x09,0x54,0x9e,0xac,0x64,0x74,0xf2,0x06,0xc4,0xee,0x08,0x44,0xf6,0x83,0x89};
+
+static const unsigned char nonce[24] = {
+  0x69,0x69,0x6e,0xe9,0x55,0xb6,0x2b,0x73,0xcd,0x62,0xbd,0xa8,0x75,0xfc,0x73,0xd6,
+  0x82,0x19,0xe0,0x03,0x6b,0x7a,0x0b,0x37};
+
+/* First 32 bytes of XSalsa20 under firstkey and nonce */
+static const unsigned char stream3[32] = {
+  0xee,0xa6,0xa7,0x25,0x1c,0x1e,0x72,0x91,0x6d,0x11,0xc2,0xcb,0x21,0x4d,0x3c,0x25,
+  0x25,0x39,0x12,0x1d,0x8e,0x23,0x4e,0x65,0x2d,0x65,0x1f,0xa4,0xc8,0xcf,0xf8,0x80};
+
+/* SHA512("abc") */
+static const unsigned char sha512_abc[64] = {
+  0xdd,0xaf,0x35,0xa1,0x93,0x61,0x7a,0xba,0xcc,0x41,0x73,0x49,0xae,0x20,0x41,0x31,
+  0x12,0xe6,0xfa,0x4e,0x89,0xa9,0x7e,0xa2,0x0a,0x9e,0xee,0xe6,0x4b,0x55,0xd3,0x9a,
+  0x21,0x92,0x99,0x2a,0x27,0x4f,0xc1,0xa8,0x36,0xba,0x3c,0x23,0xa3,0xfe,0xeb,0xbd,
+  0x45,0x4d,0x44,0x23,0x64,0x3c,0xe8,0x0e,0x2a,0x9a,0xc9,0x4f,0xa5,0x4c,0xa4,0x9f};
+
+/* SHA512 of the 112 byte two block FIPS 180-2 message */
+static const char sha512_two_msg[] =
+  "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmn"
+  "hijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+static const unsigned char sha512_two[64] = {
+  0x8e,0x95,0x9b,0x75,0xda,0xe3,0x13,0xda,0x8c,0xf4,0xf7,0x28,0x14,0xfc,0x14,0x3f,
+  0x8f,0x77,0x79,0xc6,0xeb,0x9f,0x7f,0xa1,0x72,0x99,0xae,0xad,0xb6,0x88,0x90,0x18,
+  0x50,0x1d,0x28,0x9e,0x49,0x00,0xf7,0xe4,0x33,0x1b,0x99,0xde,0xc4,0xb5,0x43,0x3a,
+  0xc7,0xd3,0x29,0xee,0xb6,0xdd,0x26,0x54,0x5e,0x96,0xe5,0x5b,0x87,0x4b,0xe9,0x09};
+
+/* Checksums over message lengths 0 .. TEST_MAXLEN-1 of m[i] = i */
+static const unsigned char hash_checksum[32] = {
+  0x2f,0xbc,0x5b,0xa3,0xb8,0x04,0xed,0x8d,0x07,0xda,0x93,0xec,0xb8,0x3d,0xfa,0x31,
+  0xc6,0x23,0x88,0x71,0xc0,0x65,0x7a,0xa6,0xb6,0x7f,0x96,0xa3,0x6c,0xf9,0x8b,0x90};
+static const unsigned char stream_checksum[32] = {
+  0xb4,0xd4,0x78,0x13,0x3a,0xba,0x2b,0x50,0x90,0x9c,0x70,0xfa,0x1c,0x52,0xef,0x00,
+  0x67,0x68,0x7b,0x70,0xdc,0xf8,0xc6,0xd8,0xf1,0xb5,0x6c,0xa9,0x1e,0x06,0xc7,0xb3};
+
+static unsigned char m[TEST_MAXLEN];
+static unsigned char c[TEST_MAXLEN];
+static unsigned char acc[128];
+static unsigned char out[64];
+static unsigned char failed;
+
+static int equal(const unsigned char *x, const unsigned char *y, uint16_t n)
+{
+  unsigned char d = 0;
+  uint16_t i;
+  for(i=0;i<n;i++)
+    d |= x[i] ^ y[i];
+  return d == 0;
+}
+
+static void result(const char *name, int ok)
+{
+  print(PRINT_TAG);
+  print(name);
+  print(ok ? ": OK" : ": FAIL");
+  print_end();
+  if(!ok)
+    failed = 1;
+}
+
+static void accumulate(const unsigned char *x, uint16_t n)
+{
+  crypto_hash_sha512(acc+64,x,n);
+  crypto_hash_sha512(acc,acc,128);
+}
+
+static void test_hash(void)
+{
+  uint16_t i;
+
+  crypto_hash_sha512(out,(const unsigned char *)"abc",3);
+  result("crypto_hash_sha512 abc", equal(out,sha512_abc,64));
+
+  crypto_hash_sha512(out,(const unsigned char *)sha512_two_msg,sizeof(sha512_two_msg)-1);
+  result("crypto_hash_sha512 two blocks", equal(out,sha512_two,64));
+
+  for(i=0;i<128;i++)
+    acc[i] = 0;
+  for(i=0;i<TEST_MAXLEN;i++)
+    accumulate(m,i);
+  result("crypto_hash_sha512 lengths", equal(acc,hash_checksum,32));
+}
+
+static void test_hashblocks(void)
+{
+  unsigned char block[128];
+  uint16_t i;
+
+  /* "abc" padded to one block leaves the digest as the state */
+  for(i=0;i<128;i++)
+    block[i] = 0;
+  block[0] = 'a'; block[1] = 'b'; block[2] = 'c';
+  block[3] = 0x80;
+  block[127] = 3 << 3;
+  for(i=0;i<64;i++)
+    out[i] = avrnacl_sha512_iv[i];
+  crypto_hashblocks_sha512(out,block,128);
+  result("crypto_hashblocks_sha512", equal(out,sha512_abc,64));
+}
+
+static void test_core(void)
+{
+  unsigned char zero[16] = {0};
+  unsigned char k[32];
+  unsigned char in[16] = {0};
+  unsigned char block[64];
+  uint16_t i;
+
+  crypto_core_hsalsa20(k,zero,shared,sigma);
+  result("crypto_core_hsalsa20", equal(k,firstkey,32));
+
+  /* First XSalsa20 block is Salsa20 under the HSalsa20 subkey */
+  crypto_core_hsalsa20(k,nonce,firstkey,sigma);
+  for(i=0;i<8;i++)
+    in[i] = nonce[16+i];
+  crypto_core_salsa20(block,in,k,sigma);
+  for(i=0;i<64;i++)
+    c[i] = 0;
+  crypto_stream_xsalsa20_xor(c,c,64,nonce,firstkey);
+  result("crypto_core_salsa20", equal(block,c,64));
+}
+
+static void test_stream(void)
+{
+  uint16_t i;
+
+  for(i=0;i<32;i++)
+    c[i] = 0;
+  crypto_stream_xsalsa20_xor(c,c,32,nonce,firstkey);
+  result("crypto_stream_xsalsa20_xor", equal(c,stream3,32));
+
+  for(i=0;i<128;i++)
+    acc[i] = 0;
+  for(i=0;i<TEST_MAXLEN;i++)
+  {
+    crypto_stream_xsalsa20_xor(c,m,i,nonce,firstkey);
+    accumulate(c,i);
+  }
+  result("crypto_stream_xsalsa20_xor lengths", equal(acc,stream_checksum,32));
+}
+
+static void test_verify(void)
+{
+  unsigned char x[32], y[32];
+  int ok = 1;
+  uint16_t i;
+
+  for(i=0;i<32;i++)
+    x[i] = y[i] = i;
+  ok &= crypto_verify_32(x,y) == 0;
+  for(i=0;i<256;i++)
+  {
+    /* Any single bit difference in any byte is caught */
+    y[i>>3] ^= 1 << (i&7);
+    ok &= crypto_verify_32(x,y) == -1;
+    y[i>>3] ^= 1 << (i&7);
+  }
+  result("crypto_verify_32", ok);
+}
+
+int main(void)
+{
+  uint16_t i;
+
+  for(i=0;i<TEST_MAXLEN;i++)
+    m[i] = i;
+
+  test_hash();
+  test_hashblocks();
+  test_core();
+  test_stream();
+  test_verify();
+
+  print(PRINT_TAG);
+  print(failed ? "some tests failed" : "all tests passed");
+  print_end();
+  sim_exit();
+  return 0;
+}
@@ -1,9 +1,17 @@
-#include <avr/pgmspace.h>
+#include <stdint.h>
+#include "hal.h"
+
+// Frame flags
+#define FRAME_MESSAGE (1 << 0)  // Data is part of the release message
+#define FRAME_MANIFEST (1 << 1) // Data is the page count and erased page bitmap
+
+// Bytes in the manifest's erased page bitmap, one bit per page
+#define ERASE_MAP_BYTES (32)
 
 struct Frame {
     unsigned char data[SPM_PAGESIZE];
     uint16_t data_size;
     uint16_t version;
     uint8_t frame_no;
-    uint8_t is_message;
+    uint8_t flags;
 };
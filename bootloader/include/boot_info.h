@@ -0,0 +1,80 @@
+/*
+ * Boot-info block headers.
+ *
+ * Before jumping to the application, the bootloader leaves what
+ * it knows about the installed image and this boot in a block at
+ * the start of SRAM, in its .noinit section. Applications include
+ * this header and read BOOT_INFO instead of going back to EEPROM.
+ * An application must link its .data above the block, e.g. with
+ * -Wl,--section-start=.data=0x800120, or its startup code will
+ * overwrite it.
+ *
+ * Later versions only add fields at the end and raise *version*;
+ * the checksum covers *size* bytes, so older readers still check it.
+ */
+
+#ifndef BOOT_INFO_H_
+#define BOOT_INFO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define BOOT_INFO_MAGIC (0xB007)
+#define BOOT_INFO_VERSION (1)
+
+// Start of SRAM on the ATmega1284P, and the bytes kept there
+// for the block; the Makefile links .noinit and .data to match
+#define BOOT_INFO_ADDRESS (0x0100)
+#define BOOT_INFO_RESERVED (32)
+
+// Values of *last_update* other than a status code
+#define BOOT_UPDATE_NONE (0xFE)     // No update since programming
+#define BOOT_UPDATE_ABORTED (0xFF)  // Cut short by a reset
+
+struct BootInfo {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t size;             // Bytes of the block, this header included
+    uint16_t checksum;        // CRC-16/XMODEM of the bytes after it
+    uint16_t fw_version;
+    uint16_t fw_bytes;
+    uint16_t message_bytes;   // Release message length, 0 if none
+    uint8_t reset_cause;      // MCUSR as found at reset
+    uint8_t last_update;      // Status of the last update: OK, an error, or BOOT_UPDATE_*
+};
+
+#define BOOT_INFO ((const struct BootInfo*)BOOT_INFO_ADDRESS)
+
+// First byte covered by the checksum
+#define BOOT_INFO_CHECKED (offsetof(struct BootInfo, fw_version))
+
+/*
+* CRC-16/XMODEM of the block after its checksum
+*/
+static inline uint16_t boot_info_checksum(const struct BootInfo *info)
+{
+    const uint8_t *p = (const uint8_t*)info;
+    uint16_t crc = 0;
+
+    for(uint8_t i = BOOT_INFO_CHECKED; i < info->size; i++){
+        crc ^= (uint16_t)p[i] << 8;
+        for(uint8_t bit = 0; bit < 8; bit++){
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/*
+* True if *info* holds a whole block from the bootloader,
+* not SRAM left over from an application started some other way
+*/
+static inline bool boot_info_valid(const struct BootInfo *info)
+{
+    return info->magic == BOOT_INFO_MAGIC && info->version >= 1 &&
+           info->size >= BOOT_INFO_CHECKED && info->size <= BOOT_INFO_RESERVED &&
+           info->checksum == boot_info_checksum(info);
+}
+
+#endif /* BOOT_INFO_H_ */
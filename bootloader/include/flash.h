@@ -0,0 +1,22 @@
+/*
+ * Asynchronous flash programming headers.
+ *
+ * A page erase or write in the RWW section runs for about
+ * 4 ms while the bootloader keeps executing from NRWW. The
+ * engine starts each step and returns; flash_poll() moves
+ * it on, and is called between received bytes so flash time
+ * overlaps with the transfer of the next frame.
+ */
+
+#ifndef FLASH_H_
+#define FLASH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void flash_program(uint32_t address, unsigned char *data, uint16_t size);
+void flash_poll(void);
+bool flash_idle(void);
+void flash_sync(void);
+
+#endif /* FLASH_H_ */
@@ -0,0 +1,22 @@
+/*
+ * Hardware abstraction layer.
+ *
+ * Covers the UART, flash page programming, EEPROM, watchdog
+ * and jumper access used by the bootloader. The AVR backend
+ * maps straight onto avr-libc; the Linux backend emulates the
+ * device so the same bootloader code runs natively.
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <stdint.h>
+#include "uart.h"
+
+#ifdef __AVR__
+#include "hal_avr.h"
+#else
+#include "hal_linux.h"
+#endif
+
+#endif /* HAL_H_ */
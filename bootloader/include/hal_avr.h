@@ -0,0 +1,168 @@
+/*
+ * AVR backend for the hardware abstraction layer.
+ *
+ * Everything is a macro or inline function over avr-libc
+ * so the target build is unchanged in size and timing.
+ */
+
+#ifndef HAL_AVR_H_
+#define HAL_AVR_H_
+
+#include <avr/io.h>
+#include <avr/boot.h>
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+// Watchdog
+#define hal_wdt_enable(timeout) wdt_enable(timeout)
+#define hal_wdt_reset() wdt_reset()
+#define hal_wdt_disable() wdt_disable()
+// Have the next timeout raise the watchdog interrupt, which
+// wakes the core, instead of resetting the device
+#define hal_wdt_wake_enable() (WDTCSR |= (1 << WDIE))
+
+/*
+* Move the interrupt vectors to the bootloader
+* section and enable interrupts
+*/
+static inline void hal_irq_init(void)
+{
+    MCUCR = (1 << IVCE);
+    MCUCR = (1 << IVSEL);
+    sei();
+}
+
+/*
+* Reset the device right away
+*/
+static inline void hal_reset(void) __attribute__((noreturn));
+static inline void hal_reset(void)
+{
+    wdt_enable(WDTO_15MS);
+    while(1) __asm__ __volatile__("");
+}
+
+/*
+* Power down until the running watchdog resets the device
+*/
+static inline void hal_halt(void) __attribute__((noreturn));
+static inline void hal_halt(void)
+{
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    while(1) sleep_cpu();
+}
+
+// EEPROM
+#define hal_eeprom_read_byte(p) eeprom_read_byte(p)
+#define hal_eeprom_read_word(p) eeprom_read_word(p)
+#define hal_eeprom_read_block(dst, p, n) eeprom_read_block(dst, p, n)
+#define hal_eeprom_update_byte(p, v) eeprom_update_byte(p, v)
+#define hal_eeprom_update_word(p, v) eeprom_update_word(p, v)
+#define hal_eeprom_update_block(src, p, n) eeprom_update_block(src, p, n)
+
+// Flash
+#define hal_flash_read_byte(address) pgm_read_byte_far(address)
+#define hal_flash_ready() (!boot_spm_busy() && eeprom_is_ready())
+
+/*
+* SPM must follow its SPMCSR store within four cycles, so
+* each is issued with interrupts off; an ISR in between
+* would leave the page operation silently undone. The
+* blocking forms wait with interrupts still enabled.
+*/
+static inline void hal_flash_fill_word(uint32_t address, uint16_t word)
+{
+    while(!hal_flash_ready());
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        boot_page_fill(address, word);
+    }
+}
+
+// Non-blocking forms; only start one when hal_flash_ready()
+static inline void hal_flash_erase_start(uint32_t address)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        boot_page_erase(address);
+    }
+}
+
+static inline void hal_flash_write_start(uint32_t address)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        boot_page_write(address);
+    }
+}
+
+static inline void hal_flash_rww_start(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        boot_rww_enable();
+    }
+}
+
+#define hal_flash_erase_page(address) do { \
+        while(!hal_flash_ready()); \
+        hal_flash_erase_start(address); \
+    } while(0)
+#define hal_flash_write_page(address) do { \
+        while(!hal_flash_ready()); \
+        hal_flash_write_start(address); \
+    } while(0)
+#define hal_flash_rww_enable() do { \
+        while(!hal_flash_ready()); \
+        hal_flash_rww_start(); \
+    } while(0)
+
+// Free SRAM between static data and the stack pointer. Measured
+// from the end of .bss: __heap_start follows .noinit, which the
+// boot-info block moves below .data
+extern char __bss_end;
+#define hal_free_ram() ((uint16_t)(SP - (uint16_t)&__bss_end))
+
+// CRC-16/XMODEM, polynomial 0x1021, for frame checks
+#define hal_crc16_update(crc, data) _crc_xmodem_update(crc, data)
+
+// MCUSR as found at reset, saved by __Init
+#define hal_reset_cause() GPIOR0
+
+/*
+* Configure Port B pins 1, 2 and 3 as jumper inputs
+*/
+static inline void hal_jumper_init(void)
+{
+    // Configure Port B Pins 1, 2, and 3 as inputs.
+    DDRB &= ~((1 << PB1) | (1 << PB2) | (1 << PB3));
+    // Enable pullup resistors - give port time to settle.
+    PORTB |= (1 << PB1) | (1 << PB2) | (1 << PB3);
+}
+
+// Jumper on Port B pin 2 selects update mode
+#define hal_update_jumper() (!(PINB & (1 << PB2)))
+// Jumper on Port B pin 3 selects readback mode
+#define hal_readback_jumper() (!(PINB & (1 << PB3)))
+// Jumper on Port B pin 1 moves the host link to SPI
+#define hal_spi_jumper() (!(PINB & (1 << PB1)))
+
+/*
+* Redirect program execution to address 0
+*
+* The application gets its own interrupt vectors
+* back with interrupts disabled
+*/
+static inline void hal_boot_application(void)
+{
+    cli();
+    UCSR0B &= ~(1 << RXCIE0);
+    UCSR1B &= ~(1 << RXCIE1);
+    MCUCR = (1 << IVCE);
+    MCUCR = 0;
+    asm ("jmp 0000");
+}
+
+#endif /* HAL_AVR_H_ */
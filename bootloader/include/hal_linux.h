@@ -0,0 +1,82 @@
+/*
+ * Linux backend for the hardware abstraction layer.
+ *
+ * Flash and EEPROM are memory mapped files, UART1 is a
+ * pseudo terminal, UART0 is stdout and a watchdog timeout
+ * re-executes the process to emulate a device reset.
+ */
+
+#ifndef HAL_LINUX_H_
+#define HAL_LINUX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ATmega1284P memory geometry
+#define SPM_PAGESIZE 256
+#define FLASHEND 0x1FFFF
+#define E2END 0xFFF
+
+// EEPROM variables live in their own section; their offset
+// into it is their address in the emulated EEPROM
+#define EEMEM __attribute__((section("eeprom")))
+
+// Watchdog timeouts, same encoding as avr-libc
+#define WDTO_15MS 0
+#define WDTO_30MS 1
+#define WDTO_60MS 2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S 6
+#define WDTO_2S 7
+
+// Watchdog
+void hal_wdt_enable(uint8_t timeout);
+void hal_wdt_reset(void);
+void hal_wdt_disable(void);
+void hal_wdt_wake_enable(void);
+
+// Interrupts and resets
+void hal_irq_init(void);
+void hal_reset(void) __attribute__((noreturn));
+void hal_halt(void) __attribute__((noreturn));
+// MCUSR bits: WDRF after an emulated reset, PORF at first start
+uint8_t hal_reset_cause(void);
+
+// EEPROM
+uint8_t hal_eeprom_read_byte(const uint8_t *p);
+uint16_t hal_eeprom_read_word(const uint16_t *p);
+void hal_eeprom_read_block(void *dst, const void *p, size_t n);
+void hal_eeprom_update_byte(uint8_t *p, uint8_t value);
+void hal_eeprom_update_word(uint16_t *p, uint16_t value);
+void hal_eeprom_update_block(const void *src, void *p, size_t n);
+
+// Flash
+uint8_t hal_flash_read_byte(uint32_t address);
+void hal_flash_erase_page(uint32_t address);
+void hal_flash_fill_word(uint32_t address, uint16_t word);
+void hal_flash_write_page(uint32_t address);
+void hal_flash_rww_enable(void);
+// Emulated flash operations finish at once
+#define hal_flash_ready() 1
+#define hal_flash_erase_start(address) hal_flash_erase_page(address)
+#define hal_flash_write_start(address) hal_flash_write_page(address)
+#define hal_flash_rww_start() hal_flash_rww_enable()
+
+// Free SRAM, as on a 1284P with little in use
+#define hal_free_ram() ((uint16_t)12288)
+
+// CRC-16/XMODEM, polynomial 0x1021, for frame checks
+uint16_t hal_crc16_update(uint16_t crc, uint8_t data);
+
+// Jumpers, selected with the BL_JUMPER environment variable
+void hal_jumper_init(void);
+uint8_t hal_update_jumper(void);
+uint8_t hal_readback_jumper(void);
+// SPI jumper is present when BL_SPI is set
+uint8_t hal_spi_jumper(void);
+
+void hal_boot_application(void);
+
+#endif /* HAL_LINUX_H_ */
@@ -0,0 +1,29 @@
+/*
+ * Device key headers.
+ *
+ * The update and readback keys are linked into their own
+ * section, .bl_keys, at KEYS_START in the last bytes of flash.
+ * A bootloader built without UD_KEY and RB_KEY is a template
+ * with blank keys; bl_provision patches each device's keys
+ * into a copy of its flash.hex, so provisioning a device does
+ * not need a compile. main() copies the keys into SRAM.
+ */
+
+#ifndef KEYS_H_
+#define KEYS_H_
+
+#define KEY_BYTES (32)
+
+// Last 64 bytes of flash; the Makefile links .bl_keys here
+#ifndef KEYS_START
+#define KEYS_START (0x1FFC0)
+#endif
+
+struct Keys {
+    unsigned char update[KEY_BYTES];
+    unsigned char readback[KEY_BYTES];
+};
+
+extern const struct Keys device_keys;
+
+#endif /* KEYS_H_ */
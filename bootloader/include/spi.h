@@ -0,0 +1,19 @@
+/*
+ * SPI slave driver headers.
+ */
+
+#ifndef SPI_H_
+#define SPI_H_
+
+#include <stdbool.h>
+
+void SPI_init(void);
+
+void SPI_putchar(unsigned char data);
+
+bool SPI_data_available(void);
+void SPI_wait(void);
+unsigned char SPI_getchar(void);
+
+void SPI_flush(void);
+#endif /* SPI_H_ */
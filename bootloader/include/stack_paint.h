@@ -0,0 +1,23 @@
+/*
+ * Stack painting instrumentation.
+ *
+ * Built only with STACK_PAINT defined; otherwise
+ * reporting compiles away.
+ */
+
+#ifndef STACK_PAINT_H_
+#define STACK_PAINT_H_
+
+#include <stdint.h>
+
+// Byte SRAM is filled with at reset
+#define STACK_CANARY 0xC5
+
+#ifdef STACK_PAINT
+uint16_t stack_unused(void);
+void stack_report(void);
+#else
+#define stack_report()
+#endif
+
+#endif /* STACK_PAINT_H_ */
@@ -0,0 +1,15 @@
+/*
+ * Status bytes sent to the host.
+ */
+
+#ifndef STATUS_H_
+#define STATUS_H_
+
+// Define UART status messages
+#define OK    ((unsigned char)0x00)
+#define MAC_ERROR ((unsigned char)0x01)
+#define VERSION_ERROR ((unsigned char)0x02)
+#define ADDRESS_ERROR ((unsigned char)0x03)
+#define NAK ((unsigned char)0x04) // Frame failed its CRC; send it again
+#define CONFIGURED ((unsigned char)0x43) // ASCII 'C'
+#endif /* STATUS_H_ */
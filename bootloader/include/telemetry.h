@@ -0,0 +1,46 @@
+/*
+ * Update telemetry headers.
+ *
+ * A block of counters in EEPROM records how firmware updates
+ * went, for reading out through an authenticated readback
+ * status request. Counts for the update in progress are kept
+ * in SRAM and written once when it completes or fails.
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Flash below the bootloader is split into this many
+// regions for erase counts
+#define TELEMETRY_REGIONS (8)
+
+struct Telemetry {
+    uint32_t bytes_received;  // Last update, all host links
+    uint32_t duration_ms;     // Last completed update
+    uint16_t attempts;
+    uint16_t completed;
+    uint16_t mac_errors;
+    uint16_t version_errors;
+    uint16_t address_errors;
+    uint16_t link_errors;     // Failed after FRAME_RETRIES damaged frames
+    uint16_t overruns;        // Failed updates that saw a UART or ring overrun
+    uint16_t naks;            // Frames failing their CRC check
+    uint16_t gaps;            // Of those, frames cut short by the host
+    uint16_t pages_written;   // Last update
+    uint16_t pages_skipped;   // Last update, erased from the manifest
+    uint16_t erases[TELEMETRY_REGIONS];
+};
+
+void telemetry_begin(void);
+void telemetry_received(uint16_t bytes);
+void telemetry_erase(uint16_t page);
+void telemetry_page(bool written);
+void telemetry_nak(bool gap);
+void telemetry_end(unsigned char status);
+uint8_t telemetry_last(void);
+
+void telemetry_send(void);
+#endif /* TELEMETRY_H_ */
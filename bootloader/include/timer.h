@@ -0,0 +1,17 @@
+/*
+ * Timer1 elapsed time headers.
+ */
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdint.h>
+
+void TIMER1_start(void);
+void TIMER1_stop(void);
+
+uint32_t TIMER1_ms(void);
+// Raw count, for timing without a division per call
+uint32_t TIMER1_ticks(void);
+uint32_t TIMER1_ms_ticks(uint16_t ms);
+#endif /* TIMER_H_ */
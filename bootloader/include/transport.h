@@ -0,0 +1,36 @@
+/*
+ * Host link transport headers.
+ *
+ * load_firmware() and readback() talk to the host through
+ * these calls, carried by UART1 or by the SPI slave port.
+ */
+
+#ifndef TRANSPORT_H_
+#define TRANSPORT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Transports
+#define TRANSPORT_UART (0)
+#define TRANSPORT_SPI (1)
+
+// Over SPI, data sent between transport_data_begin() and
+// transport_data_end() goes in blocks of up to this many
+// bytes, each after a TRANSPORT_READY byte
+#define TRANSPORT_BLOCK_BYTES (32)
+#define TRANSPORT_READY ((unsigned char)0xA5)
+
+void transport_select(uint8_t transport);
+uint8_t transport_selected(void);
+
+void transport_putchar(unsigned char data);
+void transport_data_begin(void);
+void transport_data_end(void);
+
+bool transport_data_available(void);
+void transport_wait(void);
+unsigned char transport_getchar(void);
+uint32_t transport_received(void);
+
+#endif /* TRANSPORT_H_ */
@@ -7,12 +7,17 @@
 #define UART_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 void UART1_init(void);
 
 void UART1_putchar(unsigned char data);
 
 bool UART1_data_available(void);
+void UART1_wait(void);
+void UART1_buffer_rx(bool enable);
+void UART1_receive_into(unsigned char *buf, uint16_t size);
+uint16_t UART1_received(void);
 unsigned char UART1_getchar(void);
 
 void UART1_flush(void);
@@ -25,9 +30,12 @@ void UART0_init(void);
 void UART0_putchar(unsigned char data);
 
 bool UART0_data_available(void);
+void UART0_wait(void);
 unsigned char UART0_getchar(void);
 
 void UART0_flush(void);
 
 void UART0_putstring(char* str);
+
+uint8_t UART_overruns(void);
 #endif /* UART_H_ */
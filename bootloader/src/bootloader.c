@@ -6,54 +6,242 @@
 * user with security priveleges
 */
 
-#include <avr/io.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <util/delay.h>
+#include "hal.h"
 #include "uart.h"
-#include <avr/boot.h>
-#include <avr/wdt.h>
-#include <avr/interrupt.h>
-#include <avr/pgmspace.h>
+#include "transport.h"
+#include "status.h"
+#include "telemetry.h"
+#include "flash.h"
+#include "timer.h"
+#include "keys.h"
+#include "boot_info.h"
 #include "Data.h"
+#include "stack_paint.h"
 #include "../avrnacl/avrnacl.h"
 
-// Define UART status messages
-#define OK    ((unsigned char)0x00)
-#define MAC_ERROR ((unsigned char)0x01)
-#define VERSION_ERROR ((unsigned char)0x02)
-#define CONFIGURED ((unsigned char)0x43) // ASCII 'C'
 // Define readback nonce length
 #define RB_NONCE_BYTES (24)
 // Define readback request Size
 #define RB_REQUEST_SIZE (8)
+// Readback flags travel in the top byte of the authenticated length
+#define RB_FLAG_RLE ((unsigned char)1<<0)
+// Another request follows under the same authenticator
+#define RB_FLAG_MORE ((unsigned char)1<<1)
+// Send the update telemetry block instead of flash
+#define RB_FLAG_STATUS ((unsigned char)1<<2)
+// Most ranges one readback session may request
+#define RB_MAX_RANGES (8)
+// Longest run or literal carried by one RLE packet
+#define RB_RLE_MAX (128)
 // Size of firmware frame
 #define FRAME_SIZE (SPM_PAGESIZE+6)
 // Size of protected frame and unused authenticator
 #define PROTECTED_SIZE (FRAME_SIZE+16)
 // Constant to indicate if mac generation is for update
 #define IS_UPDATE ((unsigned char)1)
+// Bytes of the next frame's digest in hash-chain mode
+#define CHAIN_DIGEST_BYTES (32)
+// Bytes of the session nonce; the rest of each frame's
+// nonce is its 64 bit position in the session
+#define SESSION_NONCE_BYTES (crypto_core_hsalsa20_INPUTBYTES)
 // Max array size for mac generation internals
-#define MAX_AR_SIZE (crypto_stream_xsalsa20_KEYBYTES+crypto_stream_xsalsa20_NONCEBYTES+PROTECTED_SIZE)
+#define MAX_AR_SIZE (crypto_stream_xsalsa20_KEYBYTES+crypto_stream_xsalsa20_NONCEBYTES+PROTECTED_SIZE+CHAIN_DIGEST_BYTES)
+// Number of application pages below the bootloader section
+#define APP_PAGES (BL_START / SPM_PAGESIZE)
+// Release message region just below the bootloader; it starts
+// with the message length, low byte first
+#ifndef MESSAGE_PAGES
+#define MESSAGE_PAGES (4)
+#endif
+#define MESSAGE_PAGE (APP_PAGES - MESSAGE_PAGES)
+#define MESSAGE_START ((uint32_t)MESSAGE_PAGE * SPM_PAGESIZE)
+#define MESSAGE_MAX (MESSAGE_PAGES * SPM_PAGESIZE - 2)
+#define MESSAGE_NONE (0xFF)
+// Bytes of each page digest kept in EEPROM
+#define PAGE_DIGEST_BYTES (4)
+// Update options, sent by the host after 'U'
+#define UPDATE_STRIPED (1 << 0) // Frames alternate between UART1 and UART0
+#define UPDATE_CHAINED (1 << 1) // Only the first frame has a MAC; each
+                                // frame carries the next frame's digest
+#define UPDATE_SESSION (1 << 2) // Frame nonces are derived from a session
+                                // nonce and the frame's position
+#define UPDATE_NONCE_FIRST (1 << 3) // Nonce is sent before the MAC, so frames
+                                    // are decrypted as they arrive
+#define UPDATE_CRC (1 << 4) // Each frame ends with a CRC-16; a damaged
+                            // frame is NAKed and sent again
+#define UPDATE_BATCH (1 << 5) // Frames come in batches, staged in SRAM
+                              // and acknowledged once per batch
+#define UPDATE_PROBE (1 << 6) // Sent alone before the options, asks for
+                              // the installed image's identity
+// Host nonce of a probe, and the identity sent back: version,
+// version zero flag and size (2 bytes each, little endian),
+// then the image digest
+#define PROBE_NONCE_BYTES (24)
+#define PROBE_DIGEST_BYTES (32)
+#define PROBE_BYTES (6 + PROBE_DIGEST_BYTES)
+// Serial links frames can arrive on, and the options this build supports
+#ifdef SINGLE_UART
+#define LANES (1)
+#define UPDATE_OPTIONS (UPDATE_CHAINED | UPDATE_SESSION | UPDATE_CRC)
+#else
+#define LANES (2)
+#define UPDATE_OPTIONS (UPDATE_STRIPED | UPDATE_CHAINED | UPDATE_SESSION | UPDATE_NONCE_FIRST | UPDATE_CRC | UPDATE_BATCH)
+#endif
+// Install order within a striped round: manifest, then the
+// message region and the image, each highest page first
+#define FRAME_RANK(f) (((f)->flags & FRAME_MANIFEST) ? 0x200 : \
+                       ((f)->flags & FRAME_MESSAGE) ? 0x100 + (f)->frame_no : (f)->frame_no)
+// Silence on the host link that ends a frame cut short
+#define FRAME_GAP_MS (50)
+// Times a damaged frame may be sent again before the update fails
+#define FRAME_RETRIES (8)
+// Most frames staged per batch
+#ifndef BATCH_FRAMES
+#define BATCH_FRAMES (8)
+#endif
+// SRAM left for the stack below load_firmware() when
+// sizing batches
+#define BATCH_RESERVE (4096)
+// Bytes of a batch of *k* frames: frame count, then frames
+#define BATCH_BYTES(k) (1 + (uint16_t)(k) * sizeof(struct WireFrame))
+// Pages rechecked on each boot after the first verified boot
+#ifndef VERIFY_PAGES
+#define VERIFY_PAGES (4)
+#endif
 
-// Access secret keys from built bootloader
-const unsigned char update_key[crypto_stream_xsalsa20_KEYBYTES] = UD_KEY;
-const unsigned char readback_key[crypto_stream_xsalsa20_KEYBYTES] = RB_KEY;
+// Device keys at KEYS_START; blank in a template build
+// until bl_provision patches them in
+const struct Keys device_keys __attribute__ ((section (".bl_keys"), used))
+#ifdef UD_KEY
+    = {UD_KEY, RB_KEY}
+#endif
+    ;
+// Working copies, loaded from flash by keys_load()
+unsigned char update_key[KEY_BYTES];
+unsigned char readback_key[KEY_BYTES];
+// Salsa20 constant for deriving the session subkey
+const unsigned char sigma[crypto_core_hsalsa20_CONSTBYTES] = "expand 32-byte k";
+
+// Frame as sent by the host; *next* is only sent in
+// hash-chain mode, *mac* only for its first frame,
+// and *nonce* not in session mode
+struct WireFrame {
+    unsigned char mac[crypto_hash_sha512_BYTES];
+    unsigned char protected_frame[PROTECTED_SIZE];
+    unsigned char nonce[crypto_stream_xsalsa20_NONCEBYTES];
+    unsigned char next[CHAIN_DIGEST_BYTES];
+};
+
+// State carried from frame to frame during an update
+struct Update {
+    uint8_t options;
+    // Frames authenticated so far; also the next
+    // frame's position in sending order
+    uint16_t frames_opened;
+    // Digest the next frame must match in hash-chain mode
+    unsigned char chain[CHAIN_DIGEST_BYTES];
+    // Session nonce and the stream subkey derived from it
+    unsigned char session[SESSION_NONCE_BYTES];
+    unsigned char subkey[crypto_core_hsalsa20_OUTPUTBYTES];
+};
+
+// Frame check while UPDATE_CRC is on
+struct Receive {
+    uint8_t check;
+    // A byte of the frame has arrived
+    uint8_t started;
+    // The host went quiet partway through the frame
+    uint8_t timed_out;
+    uint16_t crc;
+};
+
+// Batched update staging; two buffers take turns
+// being received into and being installed from
+struct Batch {
+    // Frames per batch, 0 when not batching
+    uint8_t frames;
+    unsigned char *buf[2];
+    // Buffer the next batch is received into
+    uint8_t receiving;
+    // Frames in the batch being installed, the next
+    // one to take and where it starts
+    uint8_t count;
+    uint8_t next;
+    uint16_t offset;
+    uint8_t installed;
+};
 
 // Function prototyes
+void keys_load(void);
 void load_firmware(void);
+void probe_image(void);
+void update_error(unsigned char) __attribute__((noreturn));
+void receive_frames(struct WireFrame*, uint8_t, uint16_t, uint16_t, uint16_t);
+unsigned char receive_byte(void);
+uint8_t receive_check(void);
+void receive_nak(void);
+void receive_streamed(struct Update*, struct WireFrame*, struct Frame*);
+uint8_t batch_frames(void);
+void batch_next(struct Update*, struct WireFrame*, uint16_t, uint16_t);
+void batch_end(void);
+void authenticate_frame(struct Update*, struct WireFrame*);
+void decrypt_frame(struct Update*, struct WireFrame*, struct Frame*);
+void finish_frame(struct Frame*);
+void session_nonce(struct Update*, unsigned char*);
 void write_flash(uint32_t, unsigned char*, uint16_t);
+void erase_pages(unsigned char*, uint16_t);
+uint16_t next_page(unsigned char*, uint16_t);
 void readback(void);
+void readback_rle(uint32_t, uint32_t);
+uint8_t rle_run(uint32_t, uint32_t, uint8_t);
 void boot_firmware(void);
+void boot_info_write(uint16_t);
 void create_mac(unsigned char*, unsigned char*, uint16_t, unsigned char);
 void reset_firmware_info();
+void page_digest(unsigned char*, unsigned char*);
+uint8_t verify_page(uint16_t);
+uint8_t verify_firmware(void);
 
 // EEPROM variables
 uint8_t bl_configured EEMEM = 0;
-uint16_t message_bytes EEMEM = 0;
+uint16_t message_pages EEMEM = 0;
 uint16_t fw_bytes EEMEM = 0;
 uint16_t fw_version EEMEM = 0;
 uint16_t fw_zero EEMEM = 0;
+// Boot integrity check state
+uint16_t fw_pages EEMEM = 0;
+uint8_t fw_verified EEMEM = 0;
+unsigned char fw_page_digest[APP_PAGES][PAGE_DIGEST_BYTES] EEMEM;
+
+// Left for the application at BOOT_INFO_ADDRESS, followed by
+// the page the boot integrity check continues from; both fit
+// in BOOT_INFO_RESERVED, which the application leaves alone.
+// The page survives a reset but not a power cycle, so a boot
+// writes no EEPROM once the image is verified
+struct {
+    struct BootInfo info;
+    uint16_t verify_page;
+} boot_noinit __attribute__ ((section (".noinit")));
+
+// Host link frame check state
+static struct Receive rx;
+// Staging for batched updates
+static struct Batch batch;
+
+/*
+* Copy the device keys from their flash section
+* into SRAM for the crypto routines
+*/
+void keys_load(void)
+{
+    for(uint8_t i = 0; i < KEY_BYTES; i++){
+        update_key[i] = hal_flash_read_byte(KEYS_START + offsetof(struct Keys, update) + i);
+        readback_key[i] = hal_flash_read_byte(KEYS_START + offsetof(struct Keys, readback) + i);
+    }
+}
 
 /*
 * Bootloader entry point
@@ -69,41 +257,55 @@ int main(void)
     UART1_init();
     UART1_flush();
     UART0_init();
+    // Interrupts only wake the core from idle sleep
+    hal_irq_init();
     // Enable watchdog timer; 2 Second timeout reset
-    wdt_enable(WDTO_2S);
-    wdt_reset();
+    hal_wdt_enable(WDTO_2S);
+    hal_wdt_reset();
 
     // Proceed to main bootloader functionality
     // only after being configured
     // Configured when 'C' is read on UART1
-    while(!eeprom_read_byte(&bl_configured)){
-        // Reset to top of bootloader if no configuration signal
-        while(!UART1_data_available()) wdt_reset();
+    while(!hal_eeprom_read_byte(&bl_configured)){
+        // Sleep until the configuration signal arrives,
+        // waking on the watchdog interrupt to reset it
+        while(!UART1_data_available()){
+            hal_wdt_wake_enable();
+            UART1_wait();
+            hal_wdt_reset();
+        }
         if(UART1_getchar() == CONFIGURED){
             // Set bootloader to be configured
-            eeprom_update_byte(&bl_configured, 0x01);
-            wdt_reset();
+            hal_eeprom_update_byte(&bl_configured, 0x01);
+            hal_wdt_reset();
             UART1_putchar(CONFIGURED);
             // Set to version 1
-            eeprom_update_word(&fw_version, 1);
-            wdt_reset();
+            hal_eeprom_update_word(&fw_version, 1);
+            hal_wdt_reset();
         }
     }
 
-    // Configure Port B Pins 2, and 3 as inputs.
-    DDRB &= ~((1 << PB2) | (1 << PB3));
-    // Enable pullup resistors - give port time to settle.
-    PORTB |= (1 << PB2) | (1 << PB3);
-    wdt_reset();
+    // Keys are only needed once the host is served
+    keys_load();
+
+    // Configure jumper inputs - give port time to settle.
+    hal_jumper_init();
+    hal_wdt_reset();
+
+    // If jumper is present on Port B pin 1, talk
+    // to the host over the SPI slave port
+    if(hal_spi_jumper()){
+        transport_select(TRANSPORT_SPI);
+    }
 
     // If jumper is present on Port B pin 2, load new firmware.
-    if(!(PINB & (1 << PB2))){
-        UART1_putchar('U');
+    if(hal_update_jumper()){
+        transport_putchar('U');
         load_firmware();
     }
     // If jumper is present on Port B pin 3, enter readback mode
-    else if(!(PINB & (1 << PB3))){
-        UART1_putchar('R');
+    else if(hal_readback_jumper()){
+        transport_putchar('R');
         readback();
     }
     // Boot firmware if no jumper on pins
@@ -121,182 +323,860 @@ int main(void)
 */
 void load_firmware(void)
 {
-    // Create containers for authentication and decryption processes
-    unsigned char nonce[crypto_stream_xsalsa20_NONCEBYTES];
-    unsigned char nonce_frame[crypto_stream_xsalsa20_NONCEBYTES+PROTECTED_SIZE];
-    unsigned char mac_in[crypto_hash_sha512_BYTES];
-    unsigned char mac[crypto_hash_sha512_BYTES];
-    unsigned char ciphertext[FRAME_SIZE+32]; //Extra 32 bytes for zeroes and unused authenticator
-    unsigned char plaintext[FRAME_SIZE+32]; //Extra 32 bytes for zeroes
+    // Frames as received on each lane, and once decrypted
+    struct WireFrame wire[LANES];
+    struct Frame frames[LANES];
+    unsigned char digest[crypto_hash_sha512_BYTES];
+    struct Update update = {0};
+    unsigned char options;
+    // Pages the manifest marks as erased, one bit per page
+    unsigned char erased[ERASE_MAP_BYTES] = {0};
     // Create iteration counters and intermediate storage variables
     unsigned int frames_received = 0;
-    unsigned int address = 0;
-    uint16_t num_frames = 0;
+    uint32_t address = 0;
+    uint16_t num_pages = 0;
+    uint16_t page = 0;
+    // Message pages still to come; MESSAGE_NONE
+    // until the first message frame
+    uint8_t message_left = MESSAGE_NONE;
+    uint8_t lanes = 1;
+    uint8_t first = 0;
+    uint16_t unkeyed_start = 0;
+    uint16_t wire_end = offsetof(struct WireFrame, next);
+    uint8_t done = 0;
 
     // Start the Watchdog Timer; 2 Second timeout reset
-    wdt_enable(WDTO_2S);
+    hal_wdt_enable(WDTO_2S);
+
+    // Host opens with the options it wants; echo back
+    // the ones this build supports. Striping and nonce
+    // first need UART1 as the host link, and exclude
+    // each other. Frame checks only cover the host link,
+    // so are not used with striping either. A probe
+    // may come before the options.
+    options = transport_getchar();
+    if(options == UPDATE_PROBE){
+        probe_image();
+        options = transport_getchar();
+    }
+    update.options = options & UPDATE_OPTIONS;
+    if(transport_selected() != TRANSPORT_UART) update.options &= ~(UPDATE_STRIPED | UPDATE_NONCE_FIRST | UPDATE_BATCH);
+    if(update.options & UPDATE_STRIPED) update.options &= ~(UPDATE_NONCE_FIRST | UPDATE_CRC | UPDATE_BATCH);
+    // Batches are received in the background into SRAM,
+    // which replaces nonce first and frame checks; the
+    // host is told how many frames a batch may hold
+    if(update.options & UPDATE_BATCH){
+        update.options &= ~(UPDATE_NONCE_FIRST | UPDATE_CRC);
+        batch.frames = batch_frames();
+        if(!batch.frames) update.options &= ~UPDATE_BATCH;
+    }
+    rx.check = update.options & UPDATE_CRC;
+    transport_putchar(update.options);
+    if(batch.frames) transport_putchar(batch.frames);
+    hal_wdt_reset();
+
+    // Staging for two batches, sized while the options were read
+    unsigned char stage[2 * BATCH_BYTES(batch.frames)];
 
-    // Wait for data on UART1
-    while(!UART1_data_available()) __asm__ __volatile__("");
-    wdt_reset();
+    // Count the attempt only once the host has started,
+    // not on every watchdog reset while waiting for it
+    telemetry_begin();
+
+    // Chained frames after the first leave out the MAC
+    // and add the next frame's digest
+    if(update.options & UPDATE_CHAINED){
+        unkeyed_start = sizeof(wire[0].mac);
+        wire_end = sizeof(struct WireFrame);
+    }
+
+    // Session frames leave out the nonce. The subkey for
+    // the session nonce is derived once, not per frame.
+    if(update.options & UPDATE_SESSION){
+        for(int i = 0; i < SESSION_NONCE_BYTES; i++){
+            update.session[i] = transport_getchar();
+        }
+        crypto_core_hsalsa20(update.subkey, update.session, update_key, sigma);
+        wire_end -= crypto_stream_xsalsa20_NONCEBYTES;
+        hal_wdt_reset();
+    }
+
+    // Keystream is generated while frame bytes arrive,
+    // so UART1 must buffer them meanwhile
+    if(update.options & UPDATE_NONCE_FIRST){
+        UART1_buffer_rx(true);
+    }
+
+    // First batch is received while the host keeps sending
+    if(batch.frames){
+        batch.buf[0] = stage;
+        batch.buf[1] = stage + BATCH_BYTES(batch.frames);
+        UART1_receive_into(batch.buf[0], BATCH_BYTES(batch.frames));
+    }
+
+    // HSalsa20 takes several byte times, longer than the
+    // USART buffers, so the host waits for the subkey
+    // before sending frames; receive is ready by now
+    if(update.options & UPDATE_SESSION){
+        transport_putchar(OK);
+    }
 
     // Loop until all frames have been received
-    // First iteration establishes how many iterations should
-    // occur based on first received frame's frame number
+    // First iteration establishes the image size from the
+    // manifest or the first received frame's frame number
     do
     {
-        // Read MAC from firmware updater
-        // MAC is of length crypto_hash_BYTES (64)
-        for(int i = 0; i < crypto_hash_sha512_BYTES; i++){
-            mac_in[i] = UART1_getchar();
+        // Striped rounds start with the number of
+        // frames sent, one per lane
+        if(update.options & UPDATE_STRIPED){
+            lanes = transport_getchar();
+            if(lanes == 0 || lanes > LANES){
+                update_error(ADDRESS_ERROR);
+            }
+        }
+
+        // A frame failing its check is sent again in full, so
+        // frames still arrive, and are opened, in sending order
+        for(uint8_t tries = 0; ; tries++){
+            if(batch.frames){
+                // Take the next frame out of the staged batch
+                batch_next(&update, &wire[0], unkeyed_start, wire_end);
+            }
+            else if(update.options & UPDATE_NONCE_FIRST){
+                // Read nonce, MAC and encrypted frame,
+                // decrypting while it arrives
+                receive_streamed(&update, &wire[0], &frames[0]);
+            }
+            else{
+                // Read MAC, encrypted frame and nonce on each lane
+                receive_frames(wire, lanes, update.frames_opened ? unkeyed_start : 0, unkeyed_start, wire_end);
+            }
+            if(receive_check()) break;
+            if(tries == FRAME_RETRIES) update_error(NAK);
+            receive_nak();
+        }
+
+        if(update.options & UPDATE_NONCE_FIRST){
+            authenticate_frame(&update, &wire[0]);
+            finish_frame(&frames[0]);
+            update.frames_opened += 1;
+        }
+        else{
+            // Authenticate and decrypt each frame, in the
+            // order sent when following the hash chain
+            for(uint8_t i = 0; i < lanes; i++){
+                if(update.options & UPDATE_SESSION){
+                    // Nonce was not sent; a chain digest sent
+                    // after it was received in its place
+                    unsigned char *sent = (unsigned char*)&wire[i] + offsetof(struct WireFrame, nonce);
+                    for(int j = CHAIN_DIGEST_BYTES-1; j >= 0; j--){
+                        wire[i].next[j] = sent[j];
+                    }
+                    session_nonce(&update, wire[i].nonce);
+                }
+                authenticate_frame(&update, &wire[i]);
+                decrypt_frame(&update, &wire[i], &frames[i]);
+                update.frames_opened += 1;
+            }
+        }
+
+        // Install in image order whichever lane carried each frame
+        first = (lanes > 1 && FRAME_RANK(&frames[1]) > FRAME_RANK(&frames[0]));
+
+        for(uint8_t n = 0; n < lanes && !done; n++){
+            struct Frame *frame = &frames[first ^ n];
+
+            // Let the page programmed while this frame
+            // arrived finish before writing EEPROM
+            flash_sync();
+
+            // Evaluation firmware image version number
+
+            // If version is earlier version than current firmware
+            // reset to main and generate error signal
+            if((frame->version != 0) && (frame->version < hal_eeprom_read_word(&fw_version))){
+                update_error(VERSION_ERROR);
+            }
+            // If version is zero set fw_zero flag
+            // Do not update version numberz
+            else if(frame->version == 0){
+                hal_eeprom_update_word(&fw_zero, 0x01);
+            }
+            // If frame version is not zero
+            // write new verison number to EEPROM
+            else{
+                hal_eeprom_update_word(&fw_version, frame->version);
+                // Disable firmware 0 flag
+                hal_eeprom_update_word(&fw_zero, 0x00);
+            }
+            hal_wdt_reset();
+
+            // Manifest frame lists erased pages left out of the
+            // image; it is only accepted as the first frame
+            if(frame->flags & FRAME_MANIFEST){
+                if(frames_received != 0){
+                    update_error(ADDRESS_ERROR);
+                }
+                num_pages = frame->data[0] | (frame->data[1] << 8);
+                for(int i = 0; i < ERASE_MAP_BYTES; i++){
+                    erased[i] = frame->data[2+i];
+                }
+            }
+
+            // If first iteration of installation,
+            // reset firmware information
+            if(frames_received == 0){
+                hal_eeprom_update_word(&message_pages, 0);
+                hal_eeprom_update_word(&fw_bytes, 0);
+
+                // Image must be verified again on next boot
+                hal_eeprom_update_byte(&fw_verified, 0);
+
+                // Erase the message length, so an image
+                // without a message prints none
+                hal_flash_erase_page(MESSAGE_START);
+                hal_flash_rww_enable();
+                telemetry_erase(MESSAGE_PAGE);
+            }
+
+            // Message region pages come before the image,
+            // highest first, down to the length at its start
+            if(frame->flags & FRAME_MESSAGE){
+                if(message_left == MESSAGE_NONE){
+                    if(frame->frame_no >= MESSAGE_PAGES){
+                        update_error(ADDRESS_ERROR);
+                    }
+                    message_left = frame->frame_no + 1;
+                    hal_eeprom_update_word(&message_pages, message_left);
+                }
+                if(frame->frame_no != message_left - 1){
+                    update_error(ADDRESS_ERROR);
+                }
+                message_left -= 1;
+                address = MESSAGE_START + (uint32_t)frame->frame_no * SPM_PAGESIZE;
+
+                // Store digest of programmed page for boot-time checks
+                page_digest(digest, frame->data);
+                hal_eeprom_update_block(digest, fw_page_digest[MESSAGE_PAGE + frame->frame_no], PAGE_DIGEST_BYTES);
+                hal_wdt_reset();
+
+                write_flash(address, frame->data, frame->data_size);
+                telemetry_page(true);
+                hal_wdt_reset();
+            }
+            // The manifest, or else the first image
+            // frame, gives the number of image pages
+            else if(num_pages == 0 || (frame->flags & FRAME_MANIFEST)){
+                if(!(frame->flags & FRAME_MANIFEST)){
+                    num_pages = frame->frame_no + 1;
+                }
+
+                // Check image fits below the message region
+                if(num_pages == 0 || num_pages > MESSAGE_PAGE || num_pages > ERASE_MAP_BYTES * 8){
+                    update_error(ADDRESS_ERROR);
+                }
+                hal_eeprom_update_word(&fw_pages, num_pages);
+
+                // Erase next page of data to prevent
+                // cross-firmware interference
+                hal_flash_erase_page((uint32_t)num_pages * SPM_PAGESIZE);
+                hal_flash_rww_enable();
+                telemetry_erase(num_pages);
+
+                // Erase pages listed in the manifest
+                erase_pages(erased, num_pages);
+                page = next_page(erased, num_pages);
+            }
+
+            if(!(frame->flags & (FRAME_MANIFEST | FRAME_MESSAGE))){
+                // Pages must arrive in descending order, skipping
+                // only pages the manifest marked as erased, and
+                // after the whole message
+                if(frame->frame_no != page || (message_left != MESSAGE_NONE && message_left != 0)){
+                    update_error(ADDRESS_ERROR);
+                }
+                message_left = 0;
+                address = (uint32_t)page * SPM_PAGESIZE;
+
+                // Store digest of programmed page for boot-time checks
+                page_digest(digest, frame->data);
+                hal_eeprom_update_block(digest, fw_page_digest[page], PAGE_DIGEST_BYTES);
+                hal_wdt_reset();
+
+                // Update total firmware byte size by full page size
+                hal_eeprom_update_word(&fw_bytes, hal_eeprom_read_word(&fw_bytes) + SPM_PAGESIZE);
+
+                // Start writing firmware data to flash at current
+                // address; it completes while the next frame arrives
+                write_flash(address, frame->data, frame->data_size);
+                telemetry_page(true);
+                hal_wdt_reset();
+
+                // Installation ends with page 0
+                done = (page == 0);
+                // Update next page for frame installation
+                if(!done) page = next_page(erased, page);
+                // Last page is in flash before it is acknowledged
+                else flash_sync();
+            }
+
+            #if 0
+            // Write debugging messages to UART0.
+            UART0_putchar('P');
+            UART0_putchar(page_address>>8);
+            UART0_putchar(page_address);
+            #endif
+            hal_wdt_reset();
+            // Tell host that frame has been processed, or
+            // count it towards the batch acknowledgement
+            if(batch.frames) batch.installed += 1;
+            else transport_putchar(OK);
+            // Increment number of frames processed
+            frames_received += 1;
+        }
+        //Loop while frames are pending
+    } while (!done);
+
+    UART1_buffer_rx(false);
+    if(batch.frames) batch_end();
+    telemetry_end(OK);
+    stack_report();
+} // load_firmware
+
+/*
+* Answer a probe for the installed image
+*
+* The host sends a nonce; the reply is OK, the firmware version,
+* version zero flag, size and image digest, then a MAC under
+* the readback key over the nonce and that reply, so the host
+* can trust it before skipping or refusing an update. The
+* image digest is the first PROBE_DIGEST_BYTES of SHA 512 over
+* the stored page digests of the image, then of the message
+* region pages in use.
+*/
+void probe_image(void)
+{
+    unsigned char in[PROBE_NONCE_BYTES + PROBE_BYTES];
+    unsigned char *reply = in + PROBE_NONCE_BYTES;
+    unsigned char digests[(ERASE_MAP_BYTES * 8 + MESSAGE_PAGES) * PAGE_DIGEST_BYTES];
+    unsigned char digest[crypto_hash_sha512_BYTES];
+    uint16_t image = hal_eeprom_read_word(&fw_pages);
+    uint16_t message = hal_eeprom_read_word(&message_pages);
+    uint16_t words[3];
+
+    transport_putchar(UPDATE_PROBE);
+    for(int i = 0; i < PROBE_NONCE_BYTES; i++){
+        in[i] = transport_getchar();
+    }
+    hal_wdt_reset();
+
+    // Nothing sensible is installed; report an empty image
+    if(image > ERASE_MAP_BYTES * 8 || message > MESSAGE_PAGES){
+        image = message = 0;
+    }
+    hal_eeprom_read_block(digests, fw_page_digest[0], image * PAGE_DIGEST_BYTES);
+    hal_eeprom_read_block(digests + image * PAGE_DIGEST_BYTES, fw_page_digest[MESSAGE_PAGE],
+                          message * PAGE_DIGEST_BYTES);
+    crypto_hash_sha512(digest, digests, (image + message) * PAGE_DIGEST_BYTES);
+    hal_wdt_reset();
+
+    words[0] = hal_eeprom_read_word(&fw_version);
+    words[1] = hal_eeprom_read_word(&fw_zero);
+    words[2] = hal_eeprom_read_word(&fw_bytes);
+    for(int i = 0; i < 3; i++){
+        reply[2*i] = words[i];
+        reply[2*i+1] = words[i] >> 8;
+    }
+    for(int i = 0; i < PROBE_DIGEST_BYTES; i++){
+        reply[6+i] = digest[i];
+    }
+
+    // Reply follows an OK, as readback data does, so
+    // an SPI host can poll while it is computed
+    create_mac(digest, in, sizeof(in), !IS_UPDATE);
+    transport_putchar(OK);
+    transport_data_begin();
+    for(int i = 0; i < PROBE_BYTES; i++){
+        transport_putchar(reply[i]);
+    }
+    for(int i = 0; i < crypto_hash_sha512_BYTES; i++){
+        transport_putchar(digest[i]);
+    }
+    transport_data_end();
+    hal_wdt_reset();
+} // probe_image
+
+/*
+* Abort the update
+*
+* Send *status* to the host, followed in batched updates
+* by the frames of the batch installed before the failure,
+* record the failure and reset
+*/
+void update_error(unsigned char status)
+{
+    transport_putchar(status);
+    if(batch.frames) transport_putchar(batch.installed);
+    flash_sync();
+    telemetry_end(status);
+    hal_reset();
+}
+
+/*
+* Receive one wire frame per lane from the host
+*
+* Bytes *start* up to *end* of struct WireFrame are sent, with
+* lane 0 starting at *start0*. Lane 0 is the host link and
+* lane 1 is UART0. While both are streaming they are polled
+* in turn, so neither overruns.
+*/
+void receive_frames(struct WireFrame *wire, uint8_t lanes, uint16_t start0, uint16_t start, uint16_t end)
+{
+    unsigned char *lane0 = (unsigned char*)&wire[0];
+    uint16_t received0 = start0;
+
+#ifndef SINGLE_UART
+    unsigned char *lane1 = (unsigned char*)&wire[1];
+    uint16_t received1 = (lanes > 1) ? start : end;
+
+    while(received1 < end){
+        flash_poll();
+        if(received0 < end && transport_data_available()){
+            lane0[received0++] = transport_getchar();
+        }
+        if(UART0_data_available()){
+            lane1[received1++] = UART0_getchar();
+        }
+    }
+    if(lanes > 1) telemetry_received(end - start);
+#else
+    (void)lanes;
+    (void)start;
+#endif
+
+    // Read the remaining bytes on the host link
+    while(received0 < end){
+        lane0[received0++] = receive_byte();
+    }
+    hal_wdt_reset();
+}
+
+/*
+* Read a frame byte from the host link, moving
+* flash programming on while waiting for it
+*
+* With frame checks on, the byte is added to the frame's CRC,
+* and once a frame has started a gap of FRAME_GAP_MS ends it;
+* the rest of the frame then reads as zeros and fails its check.
+*/
+unsigned char receive_byte(void)
+{
+    unsigned char c;
+    uint32_t start, gap;
+
+    flash_poll();
+    if(!rx.check){
+        return transport_getchar();
+    }
+
+    // Only time a wait; a byte already in is read straight
+    // away, and the wait loop compares raw ticks, so an SPI
+    // master clocking back to back is not overrun
+    if(rx.started && !transport_data_available()){
+        start = TIMER1_ticks();
+        gap = TIMER1_ms_ticks(FRAME_GAP_MS);
+        while(!rx.timed_out && !transport_data_available()){
+            flash_poll();
+            if(TIMER1_ticks() - start > gap) rx.timed_out = 1;
+        }
+    }
+    if(rx.timed_out) return 0;
+    rx.started = 1;
+
+    c = transport_getchar();
+    rx.crc = hal_crc16_update(rx.crc, c);
+    return c;
+}
+
+/*
+* Check the frame just received against the CRC-16 sent
+* after it, and get ready for the next frame
+*
+* The CRC is sent high byte first, so a frame received
+* intact leaves a CRC of zero. Always passes with frame
+* checks off.
+*/
+uint8_t receive_check(void)
+{
+    uint8_t intact;
+
+    if(!rx.check) return 1;
+
+    receive_byte();
+    receive_byte();
+    intact = !rx.timed_out && rx.crc == 0;
+    if(!intact) telemetry_nak(rx.timed_out);
+
+    rx.started = 0;
+    rx.timed_out = 0;
+    rx.crc = 0;
+    return intact;
+}
+
+/*
+* Ask the host to send the last frame again
+*
+* Whatever is left of the damaged frame is discarded
+* first, until the host link goes quiet.
+*/
+void receive_nak(void)
+{
+    uint32_t start = TIMER1_ms();
+
+    while(TIMER1_ms() - start <= FRAME_GAP_MS){
+        flash_poll();
+        if(transport_data_available()){
+            transport_getchar();
+            start = TIMER1_ms();
+        }
+    }
+    transport_putchar(NAK);
+    hal_wdt_reset();
+}
+
+/*
+* Frames per batch that fit in free SRAM twice over, leaving
+* BATCH_RESERVE for the stack, up to BATCH_FRAMES
+*/
+uint8_t batch_frames(void)
+{
+    uint16_t free = hal_free_ram();
+    uint16_t k;
+
+    if(free <= BATCH_RESERVE) return 0;
+    k = (free - BATCH_RESERVE) / (2 * BATCH_BYTES(1));
+    return (k < BATCH_FRAMES) ? k : BATCH_FRAMES;
+}
+
+/*
+* Take the next frame out of the staged batch
+*
+* Frame bytes *unkeyed* up to *end* of struct WireFrame are
+* copied in, and the MAC too for the first frame. Once a batch
+* is used up, its installed frames are acknowledged with OK and
+* their count. Then the bootloader waits for the next batch,
+* which was streaming in meanwhile. It starts receiving into the
+* other buffer and sends OK, so the host can send one more
+* batch while this one is installed.
+*/
+void batch_next(struct Update *u, struct WireFrame *wire, uint16_t unkeyed, uint16_t end)
+{
+    uint16_t start = u->frames_opened ? unkeyed : 0;
+    uint16_t size = 0;
+    unsigned char *buf;
+
+    if(batch.next == batch.count){
+        if(batch.count){
+            transport_putchar(OK);
+            transport_putchar(batch.installed);
         }
-        wdt_reset();
-
-        // Read encrypted frame from host
-        // Frame is of size PROTECTED_SIZE (278)
-        for(int i = 0; i < PROTECTED_SIZE; i++){
-            ciphertext[16+i] = nonce_frame[crypto_stream_xsalsa20_NONCEBYTES+i] = UART1_getchar();
-        } //for
-        wdt_reset();
-
-        // Set first 16 bytes of ciphertext to be 0
-        // (per the documentation of NACL)
-        for(int i = 0; i < 16; i++){
-            ciphertext[i] = 0;
+
+        // Batch starts with its frame count; the first frame
+        // of the update also carries the MAC
+        buf = batch.buf[batch.receiving];
+        while(size == 0 || UART1_received() < size){
+            flash_poll();
+            if(size == 0 && UART1_received() > 0){
+                if(buf[0] == 0 || buf[0] > batch.frames){
+                    update_error(ADDRESS_ERROR);
+                }
+                size = 1 + buf[0] * (end - unkeyed) + (unkeyed - start);
+            }
         }
-        wdt_reset();
+        telemetry_received(size);
+        hal_wdt_reset();
+
+        batch.count = buf[0];
+        batch.next = 0;
+        batch.offset = 1;
+        batch.installed = 0;
+        batch.receiving ^= 1;
+        UART1_receive_into(batch.buf[batch.receiving], BATCH_BYTES(batch.frames));
+        transport_putchar(OK);
+    }
+
+    buf = batch.buf[batch.receiving ^ 1];
+    for(uint16_t i = start; i < end; i++){
+        ((unsigned char*)wire)[i] = buf[batch.offset++];
+    }
+    batch.next += 1;
+}
+
+/*
+* Acknowledge the last batch and stop receiving
+*/
+void batch_end(void)
+{
+    UART1_receive_into(0, 0);
+    transport_putchar(OK);
+    transport_putchar(batch.installed);
+}
+
+/*
+* Receive a frame sent nonce first, decrypting it on arrival
+*
+* The keystream depends only on the key and nonce, so each
+* 64 byte block is generated while the ciphertext it covers
+* is still arriving; UART1 buffers bytes meanwhile.
+* The frame is not used before authenticate_frame().
+*/
+void receive_streamed(struct Update *u, struct WireFrame *wire, struct Frame *frame)
+{
+    unsigned char subkey[crypto_core_hsalsa20_OUTPUTBYTES];
+    const unsigned char *key = subkey;
+    unsigned char in[crypto_core_salsa20_INPUTBYTES] = {0};
+    unsigned char block[crypto_core_salsa20_OUTPUTBYTES];
+    uint16_t k;
 
-        // Get NONCE from host
-        // Nonce is of length crypto_stream_xsalsa20_NONCEBYTES (24)
+    // Nonce comes first, unless derived from the session
+    if(u->options & UPDATE_SESSION){
+        session_nonce(u, wire->nonce);
+        key = u->subkey;
+    }
+    else{
         for(int i = 0; i < crypto_stream_xsalsa20_NONCEBYTES; i++){
-            nonce_frame[i] = nonce[i] = UART1_getchar();
+            wire->nonce[i] = receive_byte();
         }
-        wdt_reset();
+        crypto_core_hsalsa20(subkey, wire->nonce, update_key, sigma);
+    }
 
-        // Create MAC from key, nonce, and frame
-        create_mac(mac, nonce_frame, crypto_stream_xsalsa20_NONCEBYTES+PROTECTED_SIZE, IS_UPDATE);
-        wdt_reset();
+    // MAC, unless linked by the hash chain
+    if(!(u->options & UPDATE_CHAINED) || u->frames_opened == 0){
+        for(int i = 0; i < crypto_hash_sha512_BYTES; i++){
+            wire->mac[i] = receive_byte();
+        }
+    }
+    hal_wdt_reset();
 
-        // Check authenticity of frame sent
-        // If not authentic reboot and send error
-        if(crypto_verify_32(mac_in, mac) | crypto_verify_32(mac_in+32, mac+32)){
-            UART1_putchar(MAC_ERROR);
-            while(1) __asm__ __volatile__("");
+    // Salsa20 input is the last 8 nonce bytes
+    // followed by the 64 bit block counter
+    for(int i = 0; i < 8; i++){
+        in[i] = wire->nonce[SESSION_NONCE_BYTES+i];
+    }
+
+    // Encrypted frame follows the 16 byte authenticator, and
+    // the first 32 keystream bytes are not used for it
+    for(int i = 0; i < PROTECTED_SIZE; i++){
+        k = i + 16;
+        if(i == 0 || k % crypto_core_salsa20_OUTPUTBYTES == 0){
+            in[8] = k / crypto_core_salsa20_OUTPUTBYTES;
+            crypto_core_salsa20(block, in, key, sigma);
+        }
+        wire->protected_frame[i] = receive_byte();
+        if(i >= 16){
+            *((unsigned char*)frame + i - 16) = wire->protected_frame[i] ^ block[k % crypto_core_salsa20_OUTPUTBYTES];
         }
+    }
 
-        // Alert host that MAC has been verified
-        UART1_putchar(OK);
-        wdt_reset();
-
-        // Decrypt frame using xSalsa 20 stream cipher
-        crypto_stream_xsalsa20_xor(plaintext, ciphertext, FRAME_SIZE+32, nonce, update_key);
-        // Confirm decryption
-        UART1_putchar(OK);
-
-        // Pack frame data into struct
-        // Bypass 32 zero padding bytes
-        // on plaintext
-        struct Frame frame;
-        for(int i = 0; i < FRAME_SIZE; i++){
-            *((char*)&frame + i) = plaintext[32+i];
+    if(u->options & UPDATE_CHAINED){
+        for(int i = 0; i < CHAIN_DIGEST_BYTES; i++){
+            wire->next[i] = receive_byte();
         }
-        wdt_reset();
+    }
+    hal_wdt_reset();
+}
 
-        // Evaluation firmware image version number
+/*
+* Authenticate a received frame
+*
+* The first frame, and every frame outside hash-chain mode, is
+* checked against its MAC. Later chained frames must match the
+* digest held from the frame before. In hash-chain mode the MAC
+* and digest also cover the next frame's digest, which is then
+* held for it.
+*
+* Sends OK once the frame is authenticated; resets on a mismatch
+*/
+void authenticate_frame(struct Update *u, struct WireFrame *wire)
+{
+    unsigned char nonce_frame[crypto_stream_xsalsa20_NONCEBYTES+PROTECTED_SIZE+CHAIN_DIGEST_BYTES];
+    uint16_t len = crypto_stream_xsalsa20_NONCEBYTES+PROTECTED_SIZE;
+    unsigned char mac[crypto_hash_sha512_BYTES];
+    uint8_t chained = u->options & UPDATE_CHAINED;
 
-        // If version is earlier version than current firmware
-        // reset to main and generate error signal
-        if((frame.version != 0) && (frame.version < eeprom_read_word(&fw_version))){
-            UART1_putchar(VERSION_ERROR);
-            // wait for watchdog timer to expire
-            while(1) __asm__ __volatile__("");
+    // MAC covers the nonce followed by the encrypted frame
+    for(int i = 0; i < crypto_stream_xsalsa20_NONCEBYTES; i++){
+        nonce_frame[i] = wire->nonce[i];
+    }
+    for(int i = 0; i < PROTECTED_SIZE; i++){
+        nonce_frame[crypto_stream_xsalsa20_NONCEBYTES+i] = wire->protected_frame[i];
+    }
+    if(chained){
+        for(int i = 0; i < CHAIN_DIGEST_BYTES; i++){
+            nonce_frame[len+i] = wire->next[i];
         }
-        // If version is zero set fw_zero flag
-        // Do not update version numberz
-        else if(frame.version == 0){
-            eeprom_update_word(&fw_zero, 0x01);
+        len += CHAIN_DIGEST_BYTES;
+    }
+
+    if(!chained || u->frames_opened == 0){
+        // Create MAC from key, nonce, and frame
+        create_mac(mac, nonce_frame, len, IS_UPDATE);
+        hal_wdt_reset();
+
+        // Check authenticity of frame sent
+        // If not authentic reboot and send error
+        if(crypto_verify_32(wire->mac, mac) | crypto_verify_32(wire->mac+32, mac+32)){
+            update_error(MAC_ERROR);
         }
-        // If frame version is not zero
-        // write new verison number to EEPROM
-        else{
-            eeprom_update_word(&fw_version, frame.version);
-            // Disable firmware 0 flag
-            eeprom_update_word(&fw_zero, 0x00);
+    }
+    else{
+        // A single unkeyed hash links the frame to the
+        // authenticated frame before it
+        crypto_hash_sha512(mac, nonce_frame, len);
+        hal_wdt_reset();
+
+        if(crypto_verify_32(u->chain, mac)){
+            update_error(MAC_ERROR);
         }
-        wdt_reset();
-
-        // If first iteration of installation,
-        // calculate start address of final page
-        // and derive number of iterations
-        if(frames_received == 0){
-            num_frames = frame.frame_no + 1;
-            address = frame.frame_no * SPM_PAGESIZE;
-
-            // Reset firmware and message size variables
-            eeprom_update_word(&message_bytes, 0);
-            eeprom_update_word(&fw_bytes, 0);
-
-            // Erase next page of data to prevent
-            // cross-firmware interference
-            boot_page_erase_safe(address+SPM_PAGESIZE);
-            boot_rww_enable_safe();
+    }
+
+    // Frame after this one must match the digest it carries
+    if(chained){
+        for(int i = 0; i < CHAIN_DIGEST_BYTES; i++){
+            u->chain[i] = wire->next[i];
         }
+    }
 
-        // Write firmware data to flash at current address
-        write_flash(address, frame.data, frame.data_size);
-        wdt_reset();
-
-        // Update firmware size
-
-        // If frame contains release message, increase size
-        // of message in EEPROM
-        if(frame.is_message)
-            eeprom_update_word(&message_bytes, eeprom_read_word(&message_bytes) + frame.data_size);
-        // Update total firmware byte size by full page size
-        else
-            eeprom_update_word(&fw_bytes, eeprom_read_word(&fw_bytes) + SPM_PAGESIZE);
-        // Update next address for frame installation
-        address -= SPM_PAGESIZE;
-
-        #if 0
-        // Write debugging messages to UART0.
-        UART0_putchar('P');
-        UART0_putchar(page_address>>8);
-        UART0_putchar(page_address);
-        #endif
-        wdt_reset();
-        // Tell host that frame has been processed.
-        UART1_putchar(OK);
-        // Increment number of frames processed
-        frames_received += 1;
-        //Loop while frames are pending and installation address is valid
-    } while ((frames_received < num_frames) && address >= 0);
-} // load_firmware
+    // Alert host that MAC has been verified,
+    // unless acknowledging whole batches
+    if(!batch.frames) transport_putchar(OK);
+    hal_wdt_reset();
+}
+
+/*
+* Decrypt an authenticated frame
+*
+* In session mode the frame is decrypted with Salsa20 under
+* the session subkey, which is XSalsa20 with the subkey
+* precomputed.
+*/
+void decrypt_frame(struct Update *u, struct WireFrame *wire, struct Frame *frame)
+{
+    unsigned char ciphertext[FRAME_SIZE+32]; //Extra 32 bytes for zeroes and unused authenticator
+    unsigned char plaintext[FRAME_SIZE+32]; //Extra 32 bytes for zeroes
+
+    // Set first 16 bytes of ciphertext to be 0
+    // (per the documentation of NACL)
+    for(int i = 0; i < 16; i++){
+        ciphertext[i] = 0;
+    }
+    for(int i = 0; i < PROTECTED_SIZE; i++){
+        ciphertext[16+i] = wire->protected_frame[i];
+    }
+
+    // Decrypt frame using xSalsa 20 stream cipher
+    if(u->options & UPDATE_SESSION)
+        crypto_stream_salsa20_xor(plaintext, ciphertext, FRAME_SIZE+32, wire->nonce+SESSION_NONCE_BYTES, u->subkey);
+    else
+        crypto_stream_xsalsa20_xor(plaintext, ciphertext, FRAME_SIZE+32, wire->nonce, update_key);
+
+    // Pack frame data into struct
+    // Bypass 32 zero padding bytes
+    // on plaintext
+    for(int i = 0; i < FRAME_SIZE; i++){
+        *((char*)frame + i) = plaintext[32+i];
+    }
+    finish_frame(frame);
+}
+
+/*
+* Confirm decryption and prepare the frame for installation
+*/
+void finish_frame(struct Frame *frame)
+{
+    // Confirm decryption, unless acknowledging whole batches
+    if(!batch.frames) transport_putchar(OK);
+
+    // Replace random padding with erased flash value
+    // so the page digest matches the programmed page
+    for(int i = frame->data_size; i < SPM_PAGESIZE; i++){
+        frame->data[i] = 0xFF;
+    }
+    hal_wdt_reset();
+}
+
+/*
+* Derive a frame nonce in session mode
+*
+* Nonce is the session nonce followed by the frame's
+* position in the session, little endian
+*/
+void session_nonce(struct Update *u, unsigned char *nonce)
+{
+    uint16_t position = u->frames_opened;
+
+    for(int i = 0; i < SESSION_NONCE_BYTES; i++){
+        nonce[i] = u->session[i];
+    }
+    for(int i = SESSION_NONCE_BYTES; i < crypto_stream_xsalsa20_NONCEBYTES; i++){
+        nonce[i] = position;
+        position >>= 8;
+    }
+}
 
 /*
 * Program FLASH memory with new firmware
 */
 void write_flash(uint32_t address, unsigned char *data, uint16_t size)
 {
-    // Erase old firmware data at current address
-    boot_page_erase_safe(address);
-
-    // Fill boot page with 2 byte words
-    // Write *size* bytes of data
-    for(int i = 0; i < size; i += 2){
-        uint16_t word = data[i];
-        // If size is odd, don't program second byte in word
-        word += (i < size-1) ? data[i+1] << 8 : 0;
-        boot_page_fill_safe(address+i, word);
-    }
-    wdt_reset();
-
-    // Write full firmware page to flash
-    // Enable read while write access to flash
-    boot_page_write_safe(address);
-    boot_rww_enable_safe();
+    // Erase and write run in the background; the
+    // receive loops move them on with flash_poll()
+    flash_program(address, data, size);
+    telemetry_erase(address / SPM_PAGESIZE);
 } // program_flash
 
+/*
+* Erase pages the manifest lists as erased
+*
+* Erased pages count towards the firmware size and
+* get the digest of an erased page
+*/
+void erase_pages(unsigned char *erased, uint16_t num_pages)
+{
+    unsigned char blank[SPM_PAGESIZE];
+    unsigned char digest[crypto_hash_sha512_BYTES];
+
+    for(int i = 0; i < SPM_PAGESIZE; i++){
+        blank[i] = 0xFF;
+    }
+    page_digest(digest, blank);
+    hal_wdt_reset();
+
+    for(uint16_t page = 0; page < num_pages; page++){
+        if(!(erased[page / 8] & (1 << (page % 8)))) continue;
+
+        hal_flash_erase_page((uint32_t)page * SPM_PAGESIZE);
+        hal_flash_rww_enable();
+        telemetry_erase(page);
+        telemetry_page(false);
+        hal_eeprom_update_block(digest, fw_page_digest[page], PAGE_DIGEST_BYTES);
+        hal_eeprom_update_word(&fw_bytes, hal_eeprom_read_word(&fw_bytes) + SPM_PAGESIZE);
+        hal_wdt_reset();
+    }
+} // erase_pages
+
+/*
+* Find the next page below *page* that is sent in a frame
+*
+* Page 0 is always sent, even if marked as erased
+*/
+uint16_t next_page(unsigned char *erased, uint16_t page)
+{
+    do{
+        page -= 1;
+    } while(page > 0 && (erased[page / 8] & (1 << (page % 8))));
+    return page;
+} // next_page
+
 /*
 * Read memory back to host
 * given a valid readback request
@@ -304,46 +1184,58 @@ void write_flash(uint32_t address, unsigned char *data, uint16_t size)
 void readback(void)
 {
     // Create containers for authenticators
-    unsigned char request[RB_REQUEST_SIZE];
-    unsigned char nonce_request[RB_NONCE_BYTES+RB_REQUEST_SIZE];
+    unsigned char nonce_request[RB_NONCE_BYTES+RB_MAX_RANGES*RB_REQUEST_SIZE];
     unsigned char auth[crypto_hash_sha512_BYTES];
     unsigned char auth_in[crypto_hash_sha512_BYTES];
+    // Request currently being read or served
+    unsigned char *request;
+    // Number of ranges in the session
+    uint8_t ranges = 0;
     // Start address for data readback
     uint32_t start_addr;
     // Number of bytes of data to send to host
     uint32_t bytes;
 
     // Start the Watchdog Timer
-    wdt_enable(WDTO_2S);
+    hal_wdt_enable(WDTO_2S);
 
     // Read connection authenticator from host
     // Authenticator is of length crypto_hash_sha512_BYTES (64)
     for(int i = 0; i < crypto_hash_sha512_BYTES; i++) {
-        auth_in[i] = UART1_getchar();
+        auth_in[i] = transport_getchar();
     }
-    wdt_reset();
+    hal_wdt_reset();
 
     // Read nonce from host
     // Nonce is of size RB_NONCE_BYTES (24)
     for(int i = 0; i < RB_NONCE_BYTES; i++){
-        nonce_request[i] = UART1_getchar();
+        nonce_request[i] = transport_getchar();
     }
-    wdt_reset();
+    hal_wdt_reset();
 
-    // Read request from host
-    // Request is of size RB_REQUEST_SIZE (8)
-    for(int i = 0; i < RB_REQUEST_SIZE; i++){
-        request[i] = nonce_request[RB_NONCE_BYTES+i] = UART1_getchar();
-    }
-    wdt_reset();
+    // Read requests from host
+    // Each request is of size RB_REQUEST_SIZE (8);
+    // another follows while RB_FLAG_MORE is set
+    do{
+        if(ranges == RB_MAX_RANGES){
+            transport_putchar(ADDRESS_ERROR);
+            hal_reset();
+        }
+        request = nonce_request + RB_NONCE_BYTES + ranges*RB_REQUEST_SIZE;
+        for(int i = 0; i < RB_REQUEST_SIZE; i++){
+            request[i] = transport_getchar();
+        }
+        ranges++;
+        hal_wdt_reset();
+    } while(request[4] & RB_FLAG_MORE);
 
     // Confirm data reception
-    UART1_putchar(OK);
-    wdt_reset();
+    transport_putchar(OK);
+    hal_wdt_reset();
 
-    // Create authenticator from key, nonce, and request
-    create_mac(auth, nonce_request, RB_NONCE_BYTES+RB_REQUEST_SIZE, !IS_UPDATE);
-    wdt_reset();
+    // Create authenticator from key, nonce, and every request
+    create_mac(auth, nonce_request, RB_NONCE_BYTES+ranges*RB_REQUEST_SIZE, !IS_UPDATE);
+    hal_wdt_reset();
 
     // Validate authenticator against correct
     // authenticator generated on board
@@ -351,35 +1243,101 @@ void readback(void)
     // If authenticator is not valid reset
     // back to main and send verification error
 	if(crypto_verify_32(auth_in, auth) | crypto_verify_32(auth_in+32, auth+32)) {
-		UART1_putchar(MAC_ERROR);
-		while(1) __asm__ __volatile__("");
+		transport_putchar(MAC_ERROR);
+		hal_reset();
 	}
 
     // Confirm authenticator validation
-    UART1_putchar(OK);
-	wdt_reset();
-
-    // Construct start address (4 byte value)
-    // from request
-    start_addr = ((uint32_t)request[0]) << 24;
-    start_addr |= ((uint32_t)request[1]) << 16;
-    start_addr |= ((uint32_t)request[2]) << 8;
-    start_addr |= ((uint32_t)request[3]);
-
-    // Format number of bytes to read (4 byte value)
-    // from request
-    bytes = ((uint32_t)request[4]) << 24;
-    bytes |= ((uint32_t)request[5]) << 16;
-    bytes |= ((uint32_t)request[6]) << 8;
-    bytes |= ((uint32_t)request[7]);
-    wdt_reset();
-
-    // Read specificed amount of data from memory starting at specified address
-    for(int i = 0; i < bytes; i++){
-        UART1_putchar(pgm_read_byte_far(start_addr+i));
+    transport_putchar(OK);
+	hal_wdt_reset();
+
+    // Send the ranges back to back in request order
+    transport_data_begin();
+    request = nonce_request + RB_NONCE_BYTES;
+    for(uint8_t r = 0; r < ranges; r++, request += RB_REQUEST_SIZE){
+        // Construct start address (4 byte value)
+        // from request
+        start_addr = ((uint32_t)request[0]) << 24;
+        start_addr |= ((uint32_t)request[1]) << 16;
+        start_addr |= ((uint32_t)request[2]) << 8;
+        start_addr |= ((uint32_t)request[3]);
+
+        // Format number of bytes to read (3 byte value)
+        // from request; the top byte holds the readback flags
+        bytes = ((uint32_t)request[5]) << 16;
+        bytes |= ((uint32_t)request[6]) << 8;
+        bytes |= ((uint32_t)request[7]);
+        hal_wdt_reset();
+
+        // Read specificed amount of data from memory starting at specified address
+        if(request[4] & RB_FLAG_STATUS){
+            telemetry_send();
+        }
+        else if(request[4] & RB_FLAG_RLE){
+            readback_rle(start_addr, bytes);
+        } else {
+            for(uint32_t i = 0; i < bytes; i++){
+                transport_putchar(hal_flash_read_byte(start_addr+i));
+                if(!(i & 0xFF)){
+                    hal_wdt_reset();
+                }
+            }
+        }
     }
+    transport_data_end();
+
+    stack_report();
 } // readback
 
+/*
+* Count repeats of the byte at address, up to max bytes
+*/
+uint8_t rle_run(uint32_t address, uint32_t left, uint8_t max)
+{
+    unsigned char c = hal_flash_read_byte(address);
+    uint8_t run = 1;
+
+    while(run < max && run < left && hal_flash_read_byte(address+run) == c){
+        run++;
+    }
+    return run;
+} // rle_run
+
+/*
+* Send a flash region as PackBits style packets
+*
+* Header n < 128 is followed by n+1 literal bytes,
+* header n > 128 by one byte repeated 257-n times.
+* Runs shorter than 3 stay in the literal packet.
+* Flash is read in place, so nothing is buffered.
+*/
+void readback_rle(uint32_t address, uint32_t bytes)
+{
+    uint32_t end = address + bytes;
+    uint8_t n;
+
+    while(address < end){
+        n = rle_run(address, end-address, RB_RLE_MAX);
+        if(n >= 3){
+            transport_putchar((unsigned char)(257-n));
+            transport_putchar(hal_flash_read_byte(address));
+        } else {
+            // Extend the literal until a run of 3 begins
+            n = 0;
+            while(n < RB_RLE_MAX && address+n < end &&
+                  rle_run(address+n, end-address-n, 3) < 3){
+                n++;
+            }
+            transport_putchar(n-1);
+            for(uint8_t i = 0; i < n; i++){
+                transport_putchar(hal_flash_read_byte(address+i));
+            }
+        }
+        address += n;
+        hal_wdt_reset();
+    }
+} // readback_rle
+
 /*
 * Begin execution of installed firmware
 * Print release message on serial
@@ -387,38 +1345,65 @@ void readback(void)
 void boot_firmware(void)
 {
     // Start the Watchdog Timer.
-    wdt_enable(WDTO_2S);
+    hal_wdt_enable(WDTO_2S);
 
-    // Release message begins at end of last firmware page
-    uint16_t cur_address = eeprom_read_word(&fw_bytes);
-    // Calculate end address of release message
-    uint16_t message_end = cur_address + eeprom_read_word(&message_bytes);
+    // Release message follows its length in the message region;
+    // an erased length means the image has no message
+    uint32_t cur_address = MESSAGE_START + 2;
+    uint16_t message_size = hal_flash_read_byte(MESSAGE_START) | (hal_flash_read_byte(MESSAGE_START+1) << 8);
+    uint32_t message_end = cur_address + ((message_size > MESSAGE_MAX) ? 0 : message_size);
 
     // Reset if firmware size is 0 (indicates no firmware is loaded).
-    if(cur_address == 0){
-        // Wait for watchdog timer to reset.
-        while(1) __asm__ __volatile__("");
+    if(hal_eeprom_read_word(&fw_bytes) == 0){
+        // Power down until the watchdog timer resets.
+        hal_halt();
+    }
+    hal_wdt_reset();
+
+    // Reset if installed image does not match its digests
+    if(verify_firmware()){
+        // Power down until the watchdog timer resets.
+        hal_halt();
     }
-    wdt_reset();
+    hal_wdt_reset();
 
     // Write out release message to UART0.
     while(cur_address < message_end){
-        uint8_t byte = pgm_read_byte_far(cur_address);
+        uint8_t byte = hal_flash_read_byte(cur_address);
         UART0_putchar(byte);
         cur_address += 1;
     }
     // Send end byte to show end of message
     UART0_putchar(0x01);
+    stack_report();
+
+    boot_info_write(message_end - (MESSAGE_START + 2));
 
     // Stop the Watchdog Timer.
-    wdt_reset();
-    wdt_disable();
+    hal_wdt_reset();
+    hal_wdt_disable();
 
     // Redirect program execution to address 0
     // to being firmware execution
-    asm ("jmp 0000");
+    hal_boot_application();
 } // boot_firmware
 
+/*
+* Fill in the boot-info block for the application
+*/
+void boot_info_write(uint16_t message_bytes)
+{
+    boot_noinit.info.magic = BOOT_INFO_MAGIC;
+    boot_noinit.info.version = BOOT_INFO_VERSION;
+    boot_noinit.info.size = sizeof(boot_noinit.info);
+    boot_noinit.info.fw_version = hal_eeprom_read_word(&fw_version);
+    boot_noinit.info.fw_bytes = hal_eeprom_read_word(&fw_bytes);
+    boot_noinit.info.message_bytes = message_bytes;
+    boot_noinit.info.reset_cause = hal_reset_cause();
+    boot_noinit.info.last_update = telemetry_last();
+    boot_noinit.info.checksum = boot_info_checksum(&boot_noinit.info);
+}
+
 /*
 * Create a MAC from a key and input message
 */
@@ -432,13 +1417,13 @@ void create_mac(unsigned char* out, unsigned char* in, uint16_t len, unsigned ch
     for(int i = 0; i < crypto_stream_xsalsa20_KEYBYTES; i++){
         key_in[i] = temp_hash[i] = (type == IS_UPDATE) ? update_key[i] : readback_key[i];
     }
-    wdt_reset();
+    hal_wdt_reset();
 
     // Transer input data to combined array of key and *in* message
     for(int i = 0; i < len; i++){
         key_in[crypto_stream_xsalsa20_KEYBYTES+i] = in[i];
     }
-    wdt_reset();
+    hal_wdt_reset();
 
     // Create two layer hash from key nonce and data, and key and layer 1
     // MAC has form: HASH[key : hash(key : in)]
@@ -446,3 +1431,87 @@ void create_mac(unsigned char* out, unsigned char* in, uint16_t len, unsigned ch
     crypto_hash_sha512(temp_hash+crypto_stream_xsalsa20_KEYBYTES, key_in, crypto_stream_xsalsa20_KEYBYTES+len);
     crypto_hash_sha512(out, temp_hash, crypto_stream_xsalsa20_KEYBYTES+crypto_hash_sha512_BYTES);
 }
+
+/*
+* Create the digest of one flash page
+*
+* Digest is the first PAGE_DIGEST_BYTES bytes
+* of SHA 512 over the full page
+*/
+void page_digest(unsigned char* out, unsigned char* page)
+{
+    crypto_hash_sha512(out, page, SPM_PAGESIZE);
+}
+
+/*
+* Check one installed page against its stored digest
+*
+* Returns 0 if page is intact
+*/
+uint8_t verify_page(uint16_t page)
+{
+    unsigned char data[SPM_PAGESIZE];
+    unsigned char digest[crypto_hash_sha512_BYTES];
+    unsigned char expected[PAGE_DIGEST_BYTES];
+    uint32_t address = (uint32_t)page * SPM_PAGESIZE;
+
+    // Copy page out of flash for hashing
+    for(int i = 0; i < SPM_PAGESIZE; i++){
+        data[i] = hal_flash_read_byte(address+i);
+    }
+    hal_wdt_reset();
+
+    page_digest(digest, data);
+    hal_eeprom_read_block(expected, fw_page_digest[page], PAGE_DIGEST_BYTES);
+    hal_wdt_reset();
+
+    for(int i = 0; i < PAGE_DIGEST_BYTES; i++){
+        if(digest[i] != expected[i]) return 1;
+    }
+    return 0;
+} // verify_page
+
+/*
+* Check installed image before booting it
+*
+* The first boot after an update checks every page and
+* then sets the verified flag; later boots only recheck
+* VERIFY_PAGES pages, rotating through the image and
+* the message region pages in use. The rotation starts
+* at an arbitrary page after power-on
+*
+* Returns 0 if image is intact
+*/
+uint8_t verify_firmware(void)
+{
+    uint16_t image = hal_eeprom_read_word(&fw_pages);
+    uint16_t message = hal_eeprom_read_word(&message_pages);
+    uint16_t pages = image + message;
+    uint16_t page = 0;
+    uint16_t count = pages;
+
+    // Reject page counts that cannot have been installed
+    if(image == 0 || image > MESSAGE_PAGE || message > MESSAGE_PAGES) return 1;
+
+    // Continue rotation from where the last boot stopped
+    if(hal_eeprom_read_byte(&fw_verified)){
+        page = boot_noinit.verify_page % pages;
+        count = (VERIFY_PAGES < pages) ? VERIFY_PAGES : pages;
+    }
+
+    for(uint16_t i = 0; i < count; i++){
+        if(page >= pages) page = 0;
+        // Message region pages follow the image in the rotation
+        if(verify_page((page < image) ? page : MESSAGE_PAGE + page - image)){
+            // Force a full check until a new image is installed
+            hal_eeprom_update_byte(&fw_verified, 0);
+            return 1;
+        }
+        page += 1;
+    }
+
+    boot_noinit.verify_page = page;
+    hal_eeprom_update_byte(&fw_verified, 1);
+    hal_wdt_reset();
+    return 0;
+} // verify_firmware
@@ -0,0 +1,89 @@
+/*
+ * Asynchronous flash programming code.
+ *
+ * One page is programmed at a time: the temporary page
+ * buffer is filled first, then the page is erased, written
+ * and the RWW section re-enabled, each step started once
+ * the one before has finished.
+ *
+ * SPM cannot start while an EEPROM write is in progress, nor
+ * an EEPROM write while SPM is busy. Callers run flash_sync()
+ * before writing EEPROM when a page may still be in flight.
+ */
+
+#include "flash.h"
+#include "hal.h"
+
+// Next step of the page being programmed
+#define FLASH_IDLE (0)
+#define FLASH_ERASE (1)
+#define FLASH_WRITE (2)
+#define FLASH_RWW (3)
+
+static uint8_t state = FLASH_IDLE;
+static uint32_t page_address;
+
+/*
+* Start programming *size* bytes of *data* into the page
+* at *address*; the rest of the page is left erased
+*
+* Waits for the page before to finish. *data* may be
+* reused as soon as this returns.
+*/
+void flash_program(uint32_t address, unsigned char *data, uint16_t size)
+{
+    flash_sync();
+
+    // Fill boot page with 2 byte words
+    // Write *size* bytes of data
+    for(int i = 0; i < size; i += 2){
+        uint16_t word = data[i];
+        // If size is odd, leave second byte in word erased
+        word += (i < size-1) ? data[i+1] << 8 : 0xFF00;
+        hal_flash_fill_word(address+i, word);
+    }
+    hal_wdt_reset();
+
+    page_address = address;
+    state = FLASH_ERASE;
+    flash_poll();
+}
+
+/*
+* Start the next step if flash and EEPROM are free
+*/
+void flash_poll(void)
+{
+    if(state == FLASH_IDLE || !hal_flash_ready()) return;
+
+    switch(state){
+    case FLASH_ERASE:
+        hal_flash_erase_start(page_address);
+        state = FLASH_WRITE;
+        break;
+    case FLASH_WRITE:
+        hal_flash_write_start(page_address);
+        state = FLASH_RWW;
+        break;
+    default:
+        // Application section can be read again
+        hal_flash_rww_start();
+        state = FLASH_IDLE;
+        break;
+    }
+}
+
+bool flash_idle(void)
+{
+    return state == FLASH_IDLE && hal_flash_ready();
+}
+
+/*
+* Finish the page in flight
+*/
+void flash_sync(void)
+{
+    while(!flash_idle()){
+        flash_poll();
+    }
+}
@@ -0,0 +1,609 @@
+/*
+ * Linux backend for the hardware abstraction layer.
+ *
+ * Lets load_firmware() and readback() run natively against the
+ * real host tools. Configured through the environment:
+ *   BL_FLASH    flash image file (default flash.bin)
+ *   BL_EEPROM   EEPROM image file (default eeprom.bin)
+ *   BL_UART1    optional symlink to create for the UART1 terminal
+ *   BL_UART0    if set, UART0 is a terminal behind this symlink
+ *               instead of stdin/stdout
+ *   BL_SPI      if set, the SPI jumper is present and the SPI port
+ *               is a terminal behind this symlink carrying the
+ *               same byte stream as a serial port would
+ *   BL_JUMPER   "update", "readback" or unset to boot
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+#include "hal.h"
+#include "spi.h"
+#include "timer.h"
+#include "keys.h"
+
+#define FLASH_BYTES (FLASHEND+1)
+#define EEPROM_BYTES (E2END+1)
+
+// Bounds of the EEMEM section, provided by the linker
+extern uint8_t __start_eeprom[];
+extern uint8_t __stop_eeprom[];
+
+static uint8_t *flash;
+static uint8_t *eeprom;
+// SPM temporary page buffer
+static uint8_t page_buffer[SPM_PAGESIZE];
+
+// Serial port with a receive buffer
+struct uart {
+    int rx_fd;
+    int tx_fd;
+    unsigned char rx_buf[512];
+    size_t rx_head;
+    size_t rx_tail;
+};
+
+static struct uart uart1 = {-1, -1};
+static struct uart uart0 = {STDIN_FILENO, STDOUT_FILENO};
+static struct uart spi = {-1, -1};
+
+static char **reset_argv;
+static uint8_t wdt_enabled = 0;
+static unsigned long wdt_ms = 0;
+
+/*
+* Emulate a device reset by re-executing the bootloader
+*
+* Flash and EEPROM persist in their files and the UART1
+* terminal is inherited through BL_UART1_FD
+*/
+void hal_reset(void)
+{
+    setenv("BL_RESET_CAUSE", "watchdog", 1);
+    execv("/proc/self/exe", reset_argv);
+    _exit(1);
+}
+
+static void wdt_expired(int sig)
+{
+    (void)sig;
+    hal_reset();
+}
+
+/*
+* Returning from main() leaves the device spinning
+* until the watchdog resets it, if it is running
+*/
+static void main_returned(void)
+{
+    while(wdt_enabled) pause();
+}
+
+/*
+* Map an image file, creating it erased (0xFF) if new
+*
+* *init* bytes are copied to the start of a new image,
+* as programming eeprom.hex would do
+*/
+static uint8_t* map_image(const char *path, size_t size, const uint8_t *init, size_t init_len)
+{
+    struct stat st;
+    uint8_t *image;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    if(fd < 0 || fstat(fd, &st) < 0){
+        perror(path);
+        exit(1);
+    }
+    if(st.st_size != (off_t)size && ftruncate(fd, size) < 0){
+        perror(path);
+        exit(1);
+    }
+
+    image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(image == MAP_FAILED){
+        perror(path);
+        exit(1);
+    }
+    close(fd);
+
+    if(st.st_size != (off_t)size){
+        memset(image, 0xFF, size);
+        memcpy(image, init, init_len);
+    }
+    return image;
+}
+
+/*
+* Open a pseudo terminal standing in for a UART
+*
+* The terminal is reused across emulated resets through
+* the *fd_env* variable, and *link* names an optional
+* symlink to it
+*/
+static int pty_open(const char *name, const char *fd_env, const char *link)
+{
+    const char *inherited = getenv(fd_env);
+    struct termios tio;
+    char fd_str[16];
+    int fd, slave;
+
+    if(inherited) return atoi(inherited);
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0){
+        perror("posix_openpt");
+        exit(1);
+    }
+
+    // Hold the slave side open so the terminal survives
+    // host tools closing it, and make it raw
+    slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+    if(slave < 0 || tcgetattr(slave, &tio) < 0){
+        perror(ptsname(fd));
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    snprintf(fd_str, sizeof(fd_str), "%d", fd);
+    setenv(fd_env, fd_str, 1);
+
+    if(link){
+        unlink(link);
+        if(symlink(ptsname(fd), link) < 0) perror(link);
+    }
+    fprintf(stderr, "%s on %s\n", name, ptsname(fd));
+    return fd;
+}
+
+/*
+* Set up the emulated device before main() runs
+*/
+__attribute__((constructor))
+static void hal_init(int argc, char **argv)
+{
+    struct itimerval off = {{0, 0}, {0, 0}};
+    sigset_t alarm_set;
+    const char *flash_path = getenv("BL_FLASH");
+    const char *eeprom_path = getenv("BL_EEPROM");
+
+    (void)argc;
+    reset_argv = argv;
+
+    // A reset from the watchdog handler inherits its
+    // blocked signal and running timer; clear both
+    setitimer(ITIMER_REAL, &off, NULL);
+    sigemptyset(&alarm_set);
+    sigaddset(&alarm_set, SIGALRM);
+    sigprocmask(SIG_UNBLOCK, &alarm_set, NULL);
+    signal(SIGALRM, wdt_expired);
+
+    flash = map_image(flash_path ? flash_path : "flash.bin", FLASH_BYTES, NULL, 0);
+    // The bootloader section holds the keys linked into it
+    memcpy(flash + KEYS_START, &device_keys, sizeof(device_keys));
+    eeprom = map_image(eeprom_path ? eeprom_path : "eeprom.bin", EEPROM_BYTES,
+                       __start_eeprom, __stop_eeprom - __start_eeprom);
+    memset(page_buffer, 0xFF, SPM_PAGESIZE);
+
+    uart1.rx_fd = uart1.tx_fd = pty_open("UART1", "BL_UART1_FD", getenv("BL_UART1"));
+    if(getenv("BL_UART0")){
+        uart0.rx_fd = uart0.tx_fd = pty_open("UART0", "BL_UART0_FD", getenv("BL_UART0"));
+    }
+    if(getenv("BL_SPI")){
+        spi.rx_fd = spi.tx_fd = pty_open("SPI", "BL_SPI_FD", getenv("BL_SPI"));
+    }
+    atexit(main_returned);
+}
+
+/*
+* Watchdog
+*/
+void hal_wdt_enable(uint8_t timeout)
+{
+    // Same nominal periods as the AVR: 16 ms << timeout
+    wdt_ms = 16UL << timeout;
+    wdt_enabled = 1;
+    hal_wdt_reset();
+}
+
+void hal_wdt_reset(void)
+{
+    struct itimerval t = {{0, 0}, {wdt_ms / 1000, (wdt_ms % 1000) * 1000}};
+
+    if(wdt_enabled) setitimer(ITIMER_REAL, &t, NULL);
+}
+
+void hal_wdt_disable(void)
+{
+    struct itimerval off = {{0, 0}, {0, 0}};
+
+    wdt_enabled = 0;
+    setitimer(ITIMER_REAL, &off, NULL);
+}
+
+// UART1_wait() already returns well within any timeout
+void hal_wdt_wake_enable(void)
+{
+}
+
+/*
+* Interrupts and resets
+*/
+void hal_irq_init(void)
+{
+}
+
+void hal_halt(void)
+{
+    while(1) pause();
+}
+
+uint8_t hal_reset_cause(void)
+{
+    return getenv("BL_RESET_CAUSE") ? (1 << 3) : (1 << 0);
+}
+
+/*
+* EEPROM
+*/
+static uint8_t* eeprom_cell(const void *p, size_t n)
+{
+    size_t offset = (const uint8_t*)p - __start_eeprom;
+
+    if(offset + n > EEPROM_BYTES){
+        fprintf(stderr, "EEPROM access out of range: %zu\n", offset);
+        abort();
+    }
+    return eeprom + offset;
+}
+
+uint8_t hal_eeprom_read_byte(const uint8_t *p)
+{
+    return *eeprom_cell(p, 1);
+}
+
+uint16_t hal_eeprom_read_word(const uint16_t *p)
+{
+    uint8_t *cell = eeprom_cell(p, 2);
+    return cell[0] | (cell[1] << 8);
+}
+
+void hal_eeprom_read_block(void *dst, const void *p, size_t n)
+{
+    memcpy(dst, eeprom_cell(p, n), n);
+}
+
+void hal_eeprom_update_byte(uint8_t *p, uint8_t value)
+{
+    *eeprom_cell(p, 1) = value;
+}
+
+void hal_eeprom_update_word(uint16_t *p, uint16_t value)
+{
+    uint8_t *cell = eeprom_cell(p, 2);
+    cell[0] = value;
+    cell[1] = value >> 8;
+}
+
+void hal_eeprom_update_block(const void *src, void *p, size_t n)
+{
+    memcpy(eeprom_cell(p, n), src, n);
+}
+
+/*
+* Flash
+*
+* Writes into the bootloader section are ignored,
+* as the lock bits make them on the device
+*/
+uint8_t hal_flash_read_byte(uint32_t address)
+{
+    return flash[address & FLASHEND];
+}
+
+void hal_flash_erase_page(uint32_t address)
+{
+    address &= FLASHEND & ~(SPM_PAGESIZE-1);
+    if(address < BL_START) memset(flash + address, 0xFF, SPM_PAGESIZE);
+}
+
+void hal_flash_fill_word(uint32_t address, uint16_t word)
+{
+    address &= SPM_PAGESIZE-1;
+    page_buffer[address & ~1] = word;
+    page_buffer[address | 1] = word >> 8;
+}
+
+void hal_flash_write_page(uint32_t address)
+{
+    address &= FLASHEND & ~(SPM_PAGESIZE-1);
+    // Programming can only clear bits
+    if(address < BL_START){
+        for(int i = 0; i < SPM_PAGESIZE; i++){
+            flash[address+i] &= page_buffer[i];
+        }
+    }
+    memset(page_buffer, 0xFF, SPM_PAGESIZE);
+}
+
+void hal_flash_rww_enable(void)
+{
+}
+
+/*
+* Same as avr-libc's _crc_xmodem_update()
+*/
+uint16_t hal_crc16_update(uint16_t crc, uint8_t data)
+{
+    crc ^= (uint16_t)data << 8;
+    for(int i = 0; i < 8; i++){
+        if(crc & 0x8000) crc = (crc << 1) ^ 0x1021;
+        else crc <<= 1;
+    }
+    return crc;
+}
+
+/*
+* Jumpers
+*/
+void hal_jumper_init(void)
+{
+}
+
+uint8_t hal_update_jumper(void)
+{
+    const char *jumper = getenv("BL_JUMPER");
+    return jumper && !strcmp(jumper, "update");
+}
+
+uint8_t hal_readback_jumper(void)
+{
+    const char *jumper = getenv("BL_JUMPER");
+    return jumper && !strcmp(jumper, "readback");
+}
+
+uint8_t hal_spi_jumper(void)
+{
+    return getenv("BL_SPI") != NULL;
+}
+
+/*
+* Stand-in for jumping to the application
+*/
+void hal_boot_application(void)
+{
+    fprintf(stderr, "Booting application\n");
+    exit(0);
+}
+
+/*
+* Serial ports
+*/
+static bool uart_fill(struct uart *u, int timeout)
+{
+    struct pollfd pfd = {u->rx_fd, POLLIN, 0};
+    ssize_t n;
+
+    if(poll(&pfd, 1, timeout) <= 0 || !(pfd.revents & POLLIN)) return false;
+    n = read(u->rx_fd, u->rx_buf, sizeof(u->rx_buf));
+    if(n <= 0) return false;
+    u->rx_head = n;
+    u->rx_tail = 0;
+    return true;
+}
+
+static void uart_putchar(struct uart *u, unsigned char data)
+{
+    while(write(u->tx_fd, &data, 1) < 0 && errno == EINTR);
+}
+
+static bool uart_data_available(struct uart *u)
+{
+    return (u->rx_tail < u->rx_head) || uart_fill(u, 0);
+}
+
+// Return after a byte arrives or a second passes, standing
+// in for the device waking on the watchdog interrupt
+static void uart_wait(struct uart *u)
+{
+    if(u->rx_tail >= u->rx_head) uart_fill(u, 1000);
+}
+
+static unsigned char uart_getchar(struct uart *u)
+{
+    while(u->rx_tail >= u->rx_head) uart_fill(u, -1);
+    return u->rx_buf[u->rx_tail++];
+}
+
+static void uart_putstring(struct uart *u, char *str)
+{
+    int i = 0;
+    while(str[i] != 0){
+        uart_putchar(u, str[i]);
+        i += 1;
+    }
+    uart_putchar(u, (unsigned char)0);  // make sure we send out the null terminator
+}
+
+/*
+* UART1: pseudo terminal for the host tools
+*/
+void UART1_init(void)
+{
+}
+
+void UART1_putchar(unsigned char data)
+{
+    uart_putchar(&uart1, data);
+}
+
+bool UART1_data_available(void)
+{
+    return uart_data_available(&uart1);
+}
+
+void UART1_wait(void)
+{
+    uart_wait(&uart1);
+}
+
+// Terminal input is buffered already
+void UART1_buffer_rx(bool enable)
+{
+    (void)enable;
+}
+
+// Background receive is emulated by copying out whatever
+// has arrived each time the count is asked for
+static unsigned char *rx_into;
+static uint16_t rx_into_size;
+static uint16_t rx_into_count;
+
+void UART1_receive_into(unsigned char *buf, uint16_t size)
+{
+    rx_into = buf;
+    rx_into_size = size;
+    rx_into_count = 0;
+}
+
+uint16_t UART1_received(void)
+{
+    while(rx_into && rx_into_count < rx_into_size && uart_data_available(&uart1)){
+        rx_into[rx_into_count++] = uart_getchar(&uart1);
+    }
+    return rx_into_count;
+}
+
+unsigned char UART1_getchar(void)
+{
+    return uart_getchar(&uart1);
+}
+
+void UART1_flush(void)
+{
+    while(UART1_data_available()) UART1_getchar();
+}
+
+void UART1_putstring(char* str)
+{
+    uart_putstring(&uart1, str);
+}
+
+/*
+* UART0: console on stdin/stdout, or a pseudo terminal
+*/
+void UART0_init(void)
+{
+}
+
+void UART0_putchar(unsigned char data)
+{
+    uart_putchar(&uart0, data);
+}
+
+bool UART0_data_available(void)
+{
+    return uart_data_available(&uart0);
+}
+
+void UART0_wait(void)
+{
+    uart_wait(&uart0);
+}
+
+unsigned char UART0_getchar(void)
+{
+    return uart_getchar(&uart0);
+}
+
+void UART0_flush(void)
+{
+    while(UART0_data_available()) UART0_getchar();
+}
+
+void UART0_putstring(char* str)
+{
+    uart_putstring(&uart0, str);
+}
+
+/*
+* SPI: pseudo terminal standing in for the slave port
+*/
+void SPI_init(void)
+{
+}
+
+void SPI_putchar(unsigned char data)
+{
+    uart_putchar(&spi, data);
+}
+
+bool SPI_data_available(void)
+{
+    return uart_data_available(&spi);
+}
+
+void SPI_wait(void)
+{
+    uart_wait(&spi);
+}
+
+unsigned char SPI_getchar(void)
+{
+    return uart_getchar(&spi);
+}
+
+void SPI_flush(void)
+{
+    while(SPI_data_available()) SPI_getchar();
+}
+
+// Reads never overrun on the emulated ports
+uint8_t UART_overruns(void)
+{
+    return 0;
+}
+
+/*
+* Timer1, counting wall clock time
+*/
+static struct timeval timer_start;
+
+void TIMER1_start(void)
+{
+    gettimeofday(&timer_start, NULL);
+}
+
+void TIMER1_stop(void)
+{
+}
+
+// Ticks are microseconds
+uint32_t TIMER1_ticks(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - timer_start.tv_sec) * 1000000 + (now.tv_usec - timer_start.tv_usec);
+}
+
+uint32_t TIMER1_ms_ticks(uint16_t ms)
+{
+    return (uint32_t)ms * 1000;
+}
+
+uint32_t TIMER1_ms(void)
+{
+    return TIMER1_ticks() / 1000;
+}
@@ -0,0 +1,94 @@
+/*
+ * SPI slave driver code.
+ *
+ * The host is the SPI master and clocks every byte. Bytes
+ * for the host are loaded into SPDR and go out on the
+ * master's next transfer; until then it reads back the
+ * byte it last sent.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "spi.h"
+
+// Set by the transfer complete interrupt, which
+// clears SPIF as it runs
+static volatile bool spi_received = false;
+
+/* init SPI in slave mode
+ * SS (PB4) selects the slave, MISO (PB6) is the only output
+ */
+void SPI_init(void)
+{
+    DDRB |= (1 << PB6);
+    DDRB &= ~((1 << PB4) | (1 << PB5) | (1 << PB7));
+
+    SPCR = (1 << SPE); // Enable SPI, slave, mode 0, MSB first
+}
+
+void SPI_putchar(unsigned char data)
+{
+    // Drop bytes clocked in while the host was polling, and
+    // retry if a transfer was in progress during the write
+    do{
+        (void)SPSR;
+        (void)SPDR;
+        spi_received = false;
+        SPDR = data;
+    } while(SPSR & (1 << WCOL));
+
+    while(!(SPSR & (1 << SPIF)))
+    {
+        // Wait for the master to clock the byte out
+    }
+    (void)SPDR;
+}
+
+bool SPI_data_available(void)
+{
+    return spi_received || (SPSR & (1 << SPIF)) != 0;
+}
+
+/*
+* Sleep in idle mode until the master sends a byte
+* or another interrupt (the watchdog) fires
+*/
+void SPI_wait(void)
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cli();
+    if(!SPI_data_available()){
+        SPCR |= (1 << SPIE);
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+}
+
+ISR(SPI_STC_vect)
+{
+    SPCR &= ~(1 << SPIE);
+    spi_received = true;
+}
+
+unsigned char SPI_getchar(void)
+{
+    while(!SPI_data_available())
+    {
+        /* Polled: at SPI rates the next byte can
+           complete before a wake from sleep would */
+    }
+    spi_received = false;
+    /* Get and return received data from buffer */
+    return SPDR;
+}
+
+void SPI_flush(void)
+{
+    // Tell the compiler that this variable is not being used
+    unsigned char __attribute__ ((unused)) dummy;  // GCC attributes
+    while(SPI_data_available()) dummy = SPI_getchar();
+}
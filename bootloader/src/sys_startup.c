@@ -1,9 +1,45 @@
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <avr/wdt.h>
+#include "stack_paint.h"
+#include "uart.h"
 
-void __Init         (void) __attribute__ ((naked)) __attribute__ ((section (".vectors")));
+void __vectors      (void) __attribute__ ((naked)) __attribute__ ((section (".vectors")));
+void __Init         (void) __attribute__ ((naked)) __attribute__ ((section (".init0")));
 void __jumpMain     (void) __attribute__ ((naked)) __attribute__ ((section (".init9")));
 
+/*
+* Interrupt vector table
+*
+* Only in use once main() has moved the vectors to the
+* bootloader section. Vectors without an ISR restart
+* the bootloader. The watchdog vector (8) is defined
+* below, in this file, so it cannot also get a weak
+* default here; the assembler rejects both.
+*/
+void __vectors(void)
+{
+    __asm__ __volatile__
+    (
+        "jmp __Init                 \n\t"
+        ".irp n, 1,2,3,4,5,6,7      \n\t"
+        ".weak __vector_\\n         \n\t"
+        ".set __vector_\\n, __Init  \n\t"
+        "jmp __vector_\\n           \n\t"
+        ".endr                      \n\t"
+        "jmp __vector_8             \n\t"
+        ".irp n, 9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31,32,33,34 \n\t"
+        ".weak __vector_\\n         \n\t"
+        ".set __vector_\\n, __Init  \n\t"
+        "jmp __vector_\\n           \n\t"
+        ".endr                      \n\t"
+    );
+}
+
+// The watchdog interrupt only wakes the core; the
+// hardware clears WDIE so the next timeout resets
+EMPTY_INTERRUPT(WDT_vect);
+
 void __Init(void)
 {
 #if 0
@@ -36,12 +72,33 @@ void __Init(void)
     //-------------------------------------------------------------------
 
     // Clear wdt reset flag - needed for enhanced wdt devices
+    // The reset cause is kept in GPIOR0 for the boot-info block
     #if defined(MCUCSR)
         MCUCSR = 0;
     #elif defined(MCUSR)
+        GPIOR0 = MCUSR;
         MCUSR = 0;
     #endif
 
+#ifdef STACK_PAINT
+    // Fill everything between the end of .bss and the top
+    // of SRAM with the canary, before the stack is used
+    __asm__ __volatile__
+    (
+        "ldi r30, lo8(__bss_end)    \n\t"
+        "ldi r31, hi8(__bss_end)    \n\t"
+        "ldi r26, lo8(__stack)      \n\t"
+        "ldi r27, hi8(__stack)      \n\t"
+        "ldi r24, %0                \n\t"
+        "1: st Z+, r24              \n\t"
+        "cp r26, r30                \n\t"
+        "cpc r27, r31               \n\t"
+        "brsh 1b                    \n\t"
+        :
+        : "M" (STACK_CANARY)
+    );
+#endif
+
     __asm__ __volatile__
     (
         "clr __zero_reg__    \n\t"
@@ -61,3 +118,41 @@ void __jumpMain(void)
     // jump to main()
     asm volatile ( "jmp main");
 }
+
+#ifdef STACK_PAINT
+extern uint8_t __bss_end;
+extern uint8_t __stack;
+
+/*
+* Count painted bytes the stack has never reached
+*/
+uint16_t stack_unused(void)
+{
+    uint8_t *p = &__bss_end;
+    uint16_t count = 0;
+
+    while(p <= &__stack && *p == STACK_CANARY){
+        p++;
+        count++;
+    }
+    return count;
+}
+
+/*
+* Report stack headroom on UART0
+*
+* Sends 'S', the untouched byte count and
+* the painted region size, both big endian
+*/
+void stack_report(void)
+{
+    uint16_t unused = stack_unused();
+    uint16_t painted = &__stack - &__bss_end + 1;
+
+    UART0_putchar('S');
+    UART0_putchar(unused >> 8);
+    UART0_putchar(unused);
+    UART0_putchar(painted >> 8);
+    UART0_putchar(painted);
+}
+#endif
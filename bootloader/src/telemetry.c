@@ -0,0 +1,124 @@
+/*
+ * Update telemetry code.
+ *
+ * Only attempts are counted in EEPROM as an update starts,
+ * so updates cut short by a reset still show up. Everything
+ * else is written once at the end, keeping EEPROM wear to a
+ * few cells per update.
+ */
+
+#include "telemetry.h"
+#include "boot_info.h"
+#include "status.h"
+#include "hal.h"
+#include "timer.h"
+#include "transport.h"
+
+// Pages below the bootloader in each erase count region
+#define TELEMETRY_REGION_PAGES ((BL_START / SPM_PAGESIZE + TELEMETRY_REGIONS - 1) / TELEMETRY_REGIONS)
+
+struct Telemetry telemetry EEMEM;
+// How the last update ended, for the boot-info block
+uint8_t telemetry_status EEMEM = BOOT_UPDATE_NONE;
+
+// Counts for the update in progress
+static struct Telemetry session;
+
+/*
+* Count an update attempt and start timing it
+*/
+void telemetry_begin(void)
+{
+    hal_eeprom_update_word(&telemetry.attempts, hal_eeprom_read_word(&telemetry.attempts) + 1);
+    hal_eeprom_update_byte(&telemetry_status, BOOT_UPDATE_ABORTED);
+    TIMER1_start();
+}
+
+/*
+* Count bytes received outside the host link transport
+*/
+void telemetry_received(uint16_t bytes)
+{
+    session.bytes_received += bytes;
+}
+
+void telemetry_erase(uint16_t page)
+{
+    session.erases[page / TELEMETRY_REGION_PAGES] += 1;
+}
+
+void telemetry_page(bool written)
+{
+    if(written) session.pages_written += 1;
+    else session.pages_skipped += 1;
+}
+
+/*
+* Count a frame failing its check; *gap* when the
+* host went quiet before the frame was complete
+*/
+void telemetry_nak(bool gap)
+{
+    session.naks += 1;
+    if(gap) session.gaps += 1;
+}
+
+/*
+* Record how the update ended in EEPROM
+*
+* *status* is OK for a completed update, or
+* the error sent to the host
+*/
+void telemetry_end(unsigned char status)
+{
+    struct Telemetry t;
+
+    hal_eeprom_read_block(&t, &telemetry, sizeof(t));
+
+    t.bytes_received = session.bytes_received + transport_received();
+    t.pages_written = session.pages_written;
+    t.pages_skipped = session.pages_skipped;
+    t.naks += session.naks;
+    t.gaps += session.gaps;
+    for(int i = 0; i < TELEMETRY_REGIONS; i++){
+        t.erases[i] += session.erases[i];
+    }
+
+    if(status == OK){
+        t.completed += 1;
+        t.duration_ms = TIMER1_ms();
+    }
+    else{
+        if(status == MAC_ERROR) t.mac_errors += 1;
+        else if(status == VERSION_ERROR) t.version_errors += 1;
+        else if(status == NAK) t.link_errors += 1;
+        else t.address_errors += 1;
+        if(UART_overruns()) t.overruns += 1;
+    }
+    TIMER1_stop();
+
+    hal_eeprom_update_block(&t, &telemetry, sizeof(t));
+    hal_eeprom_update_byte(&telemetry_status, status);
+    hal_wdt_reset();
+}
+
+/*
+* Status of the last update, or BOOT_UPDATE_ABORTED
+* if it was cut short
+*/
+uint8_t telemetry_last(void)
+{
+    return hal_eeprom_read_byte(&telemetry_status);
+}
+
+/*
+* Send the telemetry block to the host
+*/
+void telemetry_send(void)
+{
+    const uint8_t *p = (const uint8_t*)&telemetry;
+
+    for(uint8_t i = 0; i < sizeof(struct Telemetry); i++){
+        transport_putchar(hal_eeprom_read_byte(p + i));
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ * Timer1 elapsed time code.
+ *
+ * Timer1 counts at F_CPU/1024 and its overflow interrupt
+ * extends the count past 16 bits. The overflow only wakes
+ * an idle sleep briefly, about every 3.4 s at 20 MHz.
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "timer.h"
+
+#define TIMER1_PRESCALE (1024)
+
+static volatile uint16_t overflows = 0;
+
+void TIMER1_start(void)
+{
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    overflows = 0;
+    TIFR1 = (1 << TOV1);
+    TIMSK1 = (1 << TOIE1);
+    TCCR1B = (1 << CS12) | (1 << CS10); // Normal mode, clk/1024
+}
+
+void TIMER1_stop(void)
+{
+    TCCR1B = 0;
+    TIMSK1 = 0;
+}
+
+ISR(TIMER1_OVF_vect)
+{
+    overflows++;
+}
+
+/*
+* Timer1 ticks since TIMER1_start
+*/
+uint32_t TIMER1_ticks(void)
+{
+    uint32_t ticks;
+
+    cli();
+    ticks = TCNT1;
+    // Count an overflow that is pending but not yet serviced
+    if((TIFR1 & (1 << TOV1)) && ticks < 0x8000) ticks += 0x10000;
+    ticks += (uint32_t)overflows << 16;
+    sei();
+
+    return ticks;
+}
+
+/*
+* Timer1 ticks in *ms* milliseconds
+*/
+uint32_t TIMER1_ms_ticks(uint16_t ms)
+{
+    return (uint32_t)ms * (F_CPU / 1000) / TIMER1_PRESCALE;
+}
+
+/*
+* Milliseconds since TIMER1_start
+*/
+uint32_t TIMER1_ms(void)
+{
+    return TIMER1_ticks() * (TIMER1_PRESCALE / 8) / (F_CPU / 8000);
+}
@@ -0,0 +1,110 @@
+/*
+ * Host link transport code.
+ *
+ * Dispatches to UART1 or the SPI slave port; UART1 is
+ * used until another transport is selected.
+ */
+
+#include "transport.h"
+#include "uart.h"
+#include "spi.h"
+
+static uint8_t selected = TRANSPORT_UART;
+// Bytes read from the host link since reset
+static uint32_t received = 0;
+
+static void transport_block_send(void);
+
+// SPI data block being staged, while sending data
+static bool data_blocks = false;
+static unsigned char block[TRANSPORT_BLOCK_BYTES];
+static uint8_t block_bytes = 0;
+
+/*
+* Switch the host link to *transport*
+*/
+void transport_select(uint8_t transport)
+{
+    selected = transport;
+    if(selected == TRANSPORT_SPI) SPI_init();
+}
+
+uint8_t transport_selected(void)
+{
+    return selected;
+}
+
+void transport_putchar(unsigned char data)
+{
+    if(selected != TRANSPORT_SPI){
+        UART1_putchar(data);
+    }
+    else if(data_blocks){
+        block[block_bytes++] = data;
+        if(block_bytes == TRANSPORT_BLOCK_BYTES) transport_block_send();
+    }
+    else{
+        SPI_putchar(data);
+    }
+}
+
+/*
+* Send the staged block, after a ready byte
+*
+* The master only sees a byte once the slave has loaded it;
+* clocked any earlier it reads back its own 0xFF, which is
+* also valid data. Blocks are staged whole, so once the
+* master has the ready byte the rest follow with only the
+* reload between them, and the master needs no timing.
+*/
+static void transport_block_send(void)
+{
+    SPI_putchar(TRANSPORT_READY);
+    for(uint8_t i = 0; i < block_bytes; i++){
+        SPI_putchar(block[i]);
+    }
+    block_bytes = 0;
+}
+
+/*
+* Start sending data of any value: readback data,
+* telemetry or a probe reply, following an OK
+*/
+void transport_data_begin(void)
+{
+    data_blocks = true;
+    block_bytes = 0;
+}
+
+/*
+* Send what is left of the data
+*/
+void transport_data_end(void)
+{
+    if(data_blocks && block_bytes) transport_block_send();
+    data_blocks = false;
+}
+
+bool transport_data_available(void)
+{
+    if(selected == TRANSPORT_SPI) return SPI_data_available();
+    return UART1_data_available();
+}
+
+void transport_wait(void)
+{
+    if(selected == TRANSPORT_SPI) SPI_wait();
+    else UART1_wait();
+}
+
+unsigned char transport_getchar(void)
+{
+    received++;
+    if(selected == TRANSPORT_SPI) return SPI_getchar();
+    return UART1_getchar();
+}
+
+uint32_t transport_received(void)
+{
+    return received;
+}
@@ -3,10 +3,38 @@
  */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
 #include "uart.h"
 
+// Data overruns seen on either UART or the receive ring, saturating
+static volatile uint8_t overruns = 0;
+
+static inline void UART_overrun(void)
+{
+    if(overruns != 0xFF) overruns++;
+}
+
+static inline void UART_check_overrun(uint8_t status, uint8_t dor)
+{
+    if(status & (1 << dor)) UART_overrun();
+}
+
 #ifndef SINGLE_UART
 
+// Receive ring buffer, filled by the receive interrupt
+// while buffering is on
+#define UART1_RX_BUFFER_SIZE (128)
+static volatile unsigned char rx_buffer[UART1_RX_BUFFER_SIZE];
+static volatile uint8_t rx_head = 0;
+static volatile uint8_t rx_tail = 0;
+static volatile bool rx_buffered = false;
+
+// Linear receive target, filled by the receive interrupt
+static unsigned char * volatile rx_into = 0;
+static volatile uint16_t rx_into_size = 0;
+static volatile uint16_t rx_into_count = 0;
+
 /* init UART1
  * BAUD must be set and setbaud imported before calling this
  */
@@ -39,15 +67,118 @@ void UART1_putchar(unsigned char data)
 
 bool UART1_data_available(void)
 {
+    if(rx_buffered) return rx_head != rx_tail;
     return (UCSR1A & (1 << RXC1)) != 0;
 }
 
+/*
+* Turn interrupt driven receive buffering on or off
+*
+* While on, bytes keep arriving during long computations
+* without overrunning the two byte hardware buffer.
+* Bytes still buffered are dropped when it is turned off.
+*/
+void UART1_buffer_rx(bool enable)
+{
+    cli();
+    rx_head = rx_tail = 0;
+    rx_buffered = enable;
+    if(enable) UCSR1B |= (1 << RXCIE1);
+    else UCSR1B &= ~(1 << RXCIE1);
+    sei();
+}
+
+/*
+* Receive the next *size* bytes into *buf* in the background
+*
+* The receive interrupt stores bytes until *size* have arrived
+* and drops any after that; UART1_received() tells how many
+* are in. A null *buf* stops it. UART1_getchar must not be
+* used meanwhile.
+*/
+void UART1_receive_into(unsigned char *buf, uint16_t size)
+{
+    cli();
+    rx_into = buf;
+    rx_into_size = size;
+    rx_into_count = 0;
+    if(buf) UCSR1B |= (1 << RXCIE1);
+    else if(!rx_buffered) UCSR1B &= ~(1 << RXCIE1);
+    sei();
+}
+
+uint16_t UART1_received(void)
+{
+    uint16_t count;
+
+    cli();
+    count = rx_into_count;
+    sei();
+    return count;
+}
+
+/*
+* Sleep in idle mode until UART1 receives a byte
+* or another interrupt (the watchdog) fires
+*
+* Unless buffering, the receive interrupt only wakes the core
+* and turns itself off; the byte stays in UDR1 for UART1_getchar
+*/
+void UART1_wait(void)
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cli();
+    if(!UART1_data_available()){
+        UCSR1B |= (1 << RXCIE1);
+        sleep_enable();
+        // sei takes effect after the next instruction, so a
+        // byte arriving in between still wakes the core
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+}
+
+ISR(USART1_RX_vect)
+{
+    if(rx_into){
+        UART_check_overrun(UCSR1A, DOR1);
+        unsigned char data = UDR1;
+        if(rx_into_count < rx_into_size) rx_into[rx_into_count++] = data;
+    }
+    else if(rx_buffered){
+        UART_check_overrun(UCSR1A, DOR1);
+        unsigned char data = UDR1;
+        uint8_t next = (rx_head + 1) % UART1_RX_BUFFER_SIZE;
+        // A full ring drops the byte rather than overwrite
+        // unread ones, and counts it as an overrun
+        if(next == rx_tail){
+            UART_overrun();
+        }
+        else{
+            rx_buffer[rx_head] = data;
+            rx_head = next;
+        }
+    }
+    else{
+        UCSR1B &= ~(1 << RXCIE1);
+    }
+}
+
 unsigned char UART1_getchar(void)
 {
     while (!UART1_data_available())
     {
-        /* Wait for data to be received */
+        /* Sleep until data is received */
+        UART1_wait();
     }
+    if(rx_buffered){
+        unsigned char data = rx_buffer[rx_tail];
+        rx_tail = (rx_tail + 1) % UART1_RX_BUFFER_SIZE;
+        return data;
+    }
+    UART_check_overrun(UCSR1A, DOR1);
     /* Get and return received data from buffer */
     return UDR1;
 }
@@ -56,7 +187,7 @@ void UART1_flush(void)
 {
     // Tell the compiler that this variable is not being used
     unsigned char __attribute__ ((unused)) dummy;  // GCC attributes
-    while ( UART1_data_available() ) dummy = UDR1;
+    while ( UART1_data_available() ) dummy = UART1_getchar();
 }
 
 void UART1_putstring(char* str)
@@ -74,6 +205,12 @@ void UART1_putstring(char* str)
 inline void UART1_init(void) { return UART0_init(); }
 inline void UART1_putchar(unsigned char data) { return UART0_putchar(data); }
 inline bool UART1_data_available(void) { return UART0_data_available(); }
+inline void UART1_wait(void) { return UART0_wait(); }
+// Nothing needs receive buffering on the shared UART
+inline void UART1_buffer_rx(bool enable) { (void)enable; }
+// Nor background receive; batched updates need UART1
+inline void UART1_receive_into(unsigned char *buf, uint16_t size) { (void)buf; (void)size; }
+inline uint16_t UART1_received(void) { return 0; }
 inline unsigned char UART1_getchar(void) { return UART0_getchar(); }
 inline void UART1_flush(void ){ return UART0_flush(); }
 inline void UART1_putstring(char* str) { return UART0_putstring(str); }
@@ -116,12 +253,37 @@ bool UART0_data_available(void)
     return (UCSR0A & (1 << RXC0)) != 0;
 }
 
+/*
+* Sleep in idle mode until UART0 receives a byte
+* or another interrupt fires
+*/
+void UART0_wait(void)
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    cli();
+    if(!UART0_data_available()){
+        UCSR0B |= (1 << RXCIE0);
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+}
+
+ISR(USART0_RX_vect)
+{
+    UCSR0B &= ~(1 << RXCIE0);
+}
+
 unsigned char UART0_getchar(void)
 {
     while(!UART0_data_available())
     {
-        /* Wait for data to be received */
+        /* Sleep until data is received */
+        UART0_wait();
     }
+    UART_check_overrun(UCSR0A, DOR0);
     /* Get and return received data from buffer */
     return UDR0;
 }
@@ -145,3 +307,12 @@ void UART0_putstring(char* str)
     }
     UART0_putchar((unsigned char)0);  // make sure we send out the null terminator
 }
+
+/*
+* Number of bytes received after a data overrun,
+* plus bytes dropped because the receive ring was full
+*/
+uint8_t UART_overruns(void)
+{
+    return overruns;
+}
@@ -0,0 +1,92 @@
+/*
+ * SPI transport benchmark.
+ *
+ * Runs in simavr, reporting through the avrnacl benchmark
+ * console in its "<name> <bytes> cycles <n>" format. The SPI
+ * port is put in master mode only so transfers complete under
+ * the simulator; reading a byte takes the same path as in
+ * slave mode. Each count is the median of SPEED_RUNS bytes,
+ * from a byte being in SPDR to the loop being ready for the
+ * next, less the cost of reading the counter.
+ *
+ * uart_byte is the line time of one byte at BAUD, for
+ * comparison; spi_receive is the least SCK period, in cycles
+ * per byte, at which the slave keeps up.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#include "transport.h"
+#include "flash.h"
+#include "print.h"
+#include "cpucycles.h"
+
+#define SPEED_RUNS 15
+
+static unsigned char buf[SPEED_RUNS];
+static uint32_t overhead;
+
+/*
+* Clock one byte in and wait for it to complete
+*/
+static void spi_transfer(void)
+{
+    SPDR = 0xFF;
+    while(!(SPSR & (1 << SPIF)));
+}
+
+/*
+* Median of *n* counts
+*/
+static uint32_t median(uint32_t *t, uint8_t n)
+{
+    uint32_t x;
+
+    for(uint8_t i = 1; i < n; i++){
+        for(uint8_t j = i; j > 0 && t[j-1] > t[j]; j--){
+            x = t[j]; t[j] = t[j-1]; t[j-1] = x;
+        }
+    }
+    return t[n / 2];
+}
+
+int main(void)
+{
+    uint32_t t[SPEED_RUNS], start;
+
+    cpucycles_init();
+    start = cpucycles();
+    overhead = cpucycles() - start;
+
+    transport_select(TRANSPORT_SPI);
+    // Master at F_CPU/2, SS held as an output so it stays master
+    DDRB |= (1 << PB4) | (1 << PB5) | (1 << PB7);
+    SPCR |= (1 << MSTR);
+    SPSR |= (1 << SPI2X);
+
+    // Frame receive loop: flash_poll() and transport_getchar()
+    // per byte, as receive_frames() and receive_byte() run it
+    for(uint8_t i = 0; i < SPEED_RUNS; i++){
+        spi_transfer();
+        start = cpucycles();
+        flash_poll();
+        buf[i] = transport_getchar();
+        t[i] = cpucycles() - start - overhead;
+    }
+    print_line("spi_receive", 1, "cycles", median(t, SPEED_RUNS));
+
+    // Data block staging, per byte sent over SPI
+    transport_data_begin();
+    for(uint8_t i = 0; i < SPEED_RUNS; i++){
+        start = cpucycles();
+        transport_putchar(buf[i]);
+        t[i] = cpucycles() - start - overhead;
+    }
+    print_line("spi_stage", 1, "cycles", median(t, SPEED_RUNS));
+
+    print_line("uart_byte", 1, "cycles", (uint32_t)F_CPU * 10 / BAUD);
+
+    sim_exit();
+    return 0;
+}
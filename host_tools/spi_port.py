@@ -0,0 +1,112 @@
+"""
+SPI Port
+
+Host side of the bootloader's SPI slave transport, with the part of
+the pyserial interface the host tools use
+
+The host is the SPI master, so the bootloader can only send while
+the host clocks: reads poll with IDLE bytes until a reply appears.
+Until the bootloader loads a reply, a poll returns the last byte the
+host sent, so writes are held back and sent with a trailing IDLE byte
+when the next read starts. Status bytes are never IDLE, so read()
+skips IDLE bytes before each one. Data after a status can be any
+value, so the bootloader sends it in blocks of BLOCK_BYTES, each
+after a READY byte; read_raw() waits for READY before each block.
+"""
+
+import time
+
+IDLE = 0xFF
+# The slave must read each byte before the next one is clocked in:
+# 8 SCK periods, or 640 cycles at 250 kHz and F_CPU 20 MHz. Counting
+# the per-byte receive path (frame loop, flash_poll, transport and
+# SPI_getchar, CRC update and tick-based gap check with --crc, and a
+# Timer1 overflow landing in between) gives about 300 cycles at
+# worst, so this leaves roughly twice the time needed. At 2 MHz the
+# budget was 80 cycles. `make transport-speed` in bootloader measures
+# the path under simavr; use "spi:BUS.DEVICE@HZ" to run faster only
+# where a board has been shown to keep up.
+SPEED_HZ = 250000
+# spidev's default transfer buffer size
+CHUNK_BYTES = 4096
+# Data framing, as TRANSPORT_BLOCK_BYTES and TRANSPORT_READY
+BLOCK_BYTES = 32
+READY = 0xA5
+
+
+def open_port(name, baudrate=115200, timeout=2):
+    """Open "spi:BUS.DEVICE[@HZ]" as an SpiPort, anything else as a serial port"""
+    if name.startswith('spi:'):
+        name, _, speed_hz = name[len('spi:'):].partition('@')
+        bus, device = name.split('.')
+        return SpiPort(int(bus), int(device), speed_hz=int(speed_hz or SPEED_HZ), timeout=timeout)
+
+    import serial
+    return serial.Serial(name, baudrate=baudrate, timeout=timeout)
+
+
+class SpiPort(object):
+    def __init__(self, bus, device, speed_hz=SPEED_HZ, timeout=2):
+        import spidev
+
+        self.spi = spidev.SpiDev()
+        self.spi.open(bus, device)
+        self.spi.mode = 0
+        self.spi.max_speed_hz = speed_hz
+        self.timeout = timeout
+        self.pending = bytearray()
+        # Bytes left in the data block being read
+        self.block_left = 0
+
+    def write(self, data):
+        self.pending += bytearray(data)
+
+    def flush(self):
+        if not self.pending:
+            return
+        self.pending.append(IDLE)
+        for i in range(0, len(self.pending), CHUNK_BYTES):
+            self.spi.xfer2(list(self.pending[i:i+CHUNK_BYTES]))
+        self.pending = bytearray()
+
+    def poll(self):
+        """Clock IDLE bytes until the bootloader loads one; returns it or None"""
+        self.flush()
+        deadline = time.time() + self.timeout
+        while time.time() < deadline:
+            byte = self.spi.xfer2([IDLE])[0]
+            if byte != IDLE:
+                return byte
+        return None
+
+    def read(self, size=1):
+        """Wait for each of size status bytes"""
+        # A status ends any data before it
+        self.block_left = 0
+        data = ''
+        for _ in range(size):
+            byte = self.poll()
+            if byte is None:
+                break
+            data += chr(byte)
+        return data
+
+    def read_raw(self, size):
+        """Read size bytes of data that follow a status"""
+        data = ''
+        for _ in range(size):
+            if not self.block_left:
+                ready = self.poll()
+                if ready is None:
+                    break
+                if ready != READY:
+                    raise IOError("SPI data block starts with 0x{:02x}".format(ready))
+                self.block_left = BLOCK_BYTES
+            # Bytes of a block are loaded as fast as they go out;
+            # one transfer each leaves the slave time to reload
+            data += chr(self.spi.xfer2([IDLE])[0])
+            self.block_left -= 1
+        return data
+
+    def close(self):
+        self.spi.close()
@@ -0,0 +1,178 @@
+"""
+Protocol Trace
+
+Records every byte the host tools send to and receive from the
+bootloader, with monotonic timestamps, in a compact binary log,
+and reads such logs back
+
+The log starts with MAGIC, followed by one record per port call:
+  time (uint32) - microseconds since the log was opened
+  kind (uint8)  - SEND, RECV, MARK or NONCE, plus LANE1 for the
+                  second serial port of a striped update
+  length (uint16), then that many bytes; a mark holds a note
+                  from the tool, such as the frame being sent, and
+                  a nonce record a nonce the tool drew
+
+A trace can hand its nonces to a later run, so that run sends
+the same bytes and a replay of the trace matches it
+"""
+
+import atexit
+import struct
+import time
+import nacl.utils
+
+MAGIC = b'BLTRACE1'
+
+SEND = 0
+RECV = 1
+MARK = 2
+NONCE = 3
+LANE1 = 0x80
+
+RECORD = '<IBH'
+RECORD_BYTES = struct.calcsize(RECORD)
+
+try:
+    monotonic = time.monotonic
+except AttributeError:
+    import ctypes
+    import ctypes.util
+
+    class _Timespec(ctypes.Structure):
+        _fields_ = [('tv_sec', ctypes.c_long), ('tv_nsec', ctypes.c_long)]
+
+    _librt = ctypes.CDLL(ctypes.util.find_library('rt') or ctypes.util.find_library('c'))
+    _CLOCK_MONOTONIC = 1
+
+    def monotonic():
+        t = _Timespec()
+        _librt.clock_gettime(_CLOCK_MONOTONIC, ctypes.byref(t))
+        return t.tv_sec + t.tv_nsec * 1e-9
+
+
+class Trace(object):
+    """
+    Binary trace log shared by the ports it wraps
+    """
+    def __init__(self, path, nonces=None):
+        # Nonces of an earlier trace, read before *path*
+        # is opened, as it may be the same file
+        self.nonces = [r.data for r in read_trace(nonces) if r.op == NONCE] if nonces else []
+        self.log = open(path, 'wb')
+        self.log.write(MAGIC)
+        self.start = monotonic()
+        # Failed updates are the ones worth a trace
+        atexit.register(self.close)
+
+    def record(self, kind, data):
+        t = int((monotonic() - self.start) * 1e6) & 0xFFFFFFFF
+        self.log.write(struct.pack(RECORD, t, kind, len(data)) + data)
+
+    def mark(self, note):
+        self.record(MARK, note)
+
+    def nonce(self, size):
+        if self.nonces:
+            data = self.nonces.pop(0)
+            if len(data) != size:
+                raise RuntimeError("Nonce from the earlier trace is {} bytes, not {}".format(
+                    len(data), size))
+        else:
+            data = nacl.utils.random(size)
+        self.record(NONCE, data)
+        return data
+
+    def wrap(self, port, lane=0):
+        return TracePort(self, port, LANE1 if lane else 0)
+
+    def close(self):
+        if not self.log.closed:
+            self.log.close()
+
+
+class TracePort(object):
+    """
+    Port that records its traffic in a Trace; anything
+    else is passed on to the wrapped port
+    """
+    def __init__(self, trace, port, lane):
+        self.trace = trace
+        self.port = port
+        self.lane = lane
+
+    def write(self, data):
+        self.trace.record(SEND | self.lane, data)
+        return self.port.write(data)
+
+    def read(self, size=1):
+        data = self.port.read(size)
+        self.trace.record(RECV | self.lane, data)
+        return data
+
+    def read_raw(self, size):
+        data = getattr(self.port, 'read_raw', self.port.read)(size)
+        self.trace.record(RECV | self.lane, data)
+        return data
+
+    def mark(self, note):
+        self.trace.mark(note)
+
+    def nonce(self, size):
+        return self.trace.nonce(size)
+
+    def __getattr__(self, name):
+        return getattr(self.port, name)
+
+
+def mark(port, note, phases=()):
+    """
+    Notes what the following traffic on a traced *port* is;
+    *phases* name the replies it should get, in order
+    """
+    if hasattr(port, 'mark'):
+        port.mark('{}:{}'.format(note, ','.join(phases)))
+
+
+def draw_nonce(port, size):
+    """
+    Draws a random *size* byte nonce; a traced *port* records
+    it, or reuses the next nonce of the trace it was given
+    """
+    if hasattr(port, 'nonce'):
+        return port.nonce(size)
+    return nacl.utils.random(size)
+
+
+class Record(object):
+    def __init__(self, time, kind, data):
+        self.time = time
+        self.kind = kind
+        self.data = data
+
+    @property
+    def lane(self):
+        return 1 if self.kind & LANE1 else 0
+
+    @property
+    def op(self):
+        return self.kind & ~LANE1
+
+
+def read_trace(path):
+    """
+    Returns the records of a trace log, times in seconds
+    """
+    with open(path, 'rb') as f:
+        log = f.read()
+    if not log.startswith(MAGIC):
+        raise RuntimeError("{} is not a trace log".format(path))
+
+    records = []
+    pos = len(MAGIC)
+    while pos + RECORD_BYTES <= len(log):
+        t, kind, length = struct.unpack_from(RECORD, log, pos)
+        pos += RECORD_BYTES
+        records.append(Record(t / 1e6, kind, log[pos:pos+length]))
+        pos += length
+    return records